@@ -0,0 +1,388 @@
+#include <benchmark/benchmark.h>
+#include <zlib.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "RGVM.h"
+#include "bundle.h"
+#include "dfa.h"
+#include "gzip_scan.h"
+#include "incremental.h"
+#include "matrix.h"
+#include "rewrite.h"
+#include "static_regex.h"
+#include "stream.h"
+
+namespace {
+
+// Number of heap allocations made by the whole process, including the RGVM
+// shared library. Replacing the global operator new is the only portable way to
+// observe allocations made inside the library.
+std::atomic<uint64_t> g_allocations{0};
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc();
+}
+
+// GCC cannot see that operator new above is malloc based.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+namespace {
+
+// Reports the average number of allocations per iteration, measured since
+// |start|.
+void ReportAllocations(benchmark::State& state, uint64_t start) {
+  state.counters["allocs"] = benchmark::Counter(
+      static_cast<double>(g_allocations.load() - start),
+      benchmark::Counter::kAvgIterations);
+}
+
+std::string Repeat(const std::string& s, unsigned n) {
+  std::string out;
+  out.reserve(s.size() * n);
+  for (unsigned i = 0; i < n; ++i) out += s;
+  return out;
+}
+
+// (a?){n}a{n}: the classic pathological pattern for backtracking engines.
+std::string PathologicalRegexp(unsigned n) {
+  return Repeat("(a?)", n) + Repeat("a", n);
+}
+
+// Long keyword list, e.g. "kw0|kw1|...|kwN".
+std::string KeywordRegexp(unsigned n) {
+  std::string regexp;
+  for (unsigned i = 0; i < n; ++i) {
+    if (i) regexp += '|';
+    regexp += "kw" + std::to_string(i * 7919) + "x";
+  }
+  return regexp;
+}
+
+const char kLogRegexp[] = "ERROR.*refused";
+const char kCaptureRegexp[] = "(a+)(b+)(c+)(d+)(e+)";
+
+// Synthetic log file of roughly |size| bytes. The only error line is at the
+// very end so that the whole input has to be scanned.
+std::string LogInput(unsigned size) {
+  const std::string line =
+      "2021-05-02T10:00:00 INFO worker 17 handled request in 3ms\n";
+  std::string input = Repeat(line, size / line.size() + 1);
+  input.resize(size);
+  input += "ERROR upstream 10.0.0.7 connection was refused\n";
+  return input;
+}
+
+// Text of roughly |size| bytes over the alphabet of |kCaptureRegexp| with the
+// single match at the end.
+std::string CaptureInput(unsigned size) {
+  std::string input = Repeat("abcdxbbcd", size / 9 + 1);
+  input.resize(size);
+  input += "aaabbbcccdddeee";
+  return input;
+}
+
+void BM_Parse(benchmark::State& state, const std::string& regexp) {
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    RGVM::RegexPtr rp;
+    benchmark::DoNotOptimize(RGVM::Parse(regexp, rp));
+  }
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * regexp.size());
+}
+
+void BM_Compile(benchmark::State& state, const std::string& regexp) {
+  RGVM::RegexPtr rp;
+  if (!RGVM::Parse(regexp, rp)) state.SkipWithError("parse failed");
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) benchmark::DoNotOptimize(RGVM::Compile(rp));
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * regexp.size());
+}
+
+void BM_Search(benchmark::State& state, const std::string& regexp,
+               const std::string& input,
+               RGVM::Engine engine = RGVM::Engine::Auto) {
+  RGVM::VM vm;
+  vm.SetEngine(engine);
+  if (!vm.Compile(regexp)) state.SkipWithError("compile failed");
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) benchmark::DoNotOptimize(vm.Search(input));
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void BM_ParsePathological(benchmark::State& state) {
+  BM_Parse(state, PathologicalRegexp(state.range(0)));
+}
+BENCHMARK(BM_ParsePathological)->Arg(8)->Arg(32);
+
+void BM_ParseKeywords(benchmark::State& state) {
+  BM_Parse(state, KeywordRegexp(state.range(0)));
+}
+BENCHMARK(BM_ParseKeywords)->Arg(16)->Arg(256);
+
+void BM_ParseCapture(benchmark::State& state) {
+  BM_Parse(state, kCaptureRegexp);
+}
+BENCHMARK(BM_ParseCapture);
+
+void BM_CompilePathological(benchmark::State& state) {
+  BM_Compile(state, PathologicalRegexp(state.range(0)));
+}
+BENCHMARK(BM_CompilePathological)->Arg(8)->Arg(32);
+
+void BM_CompileKeywords(benchmark::State& state) {
+  BM_Compile(state, KeywordRegexp(state.range(0)));
+}
+BENCHMARK(BM_CompileKeywords)->Arg(16)->Arg(256);
+
+// A bundle of 1024 keyword rules over state.range(0) threads.
+void BM_CompileAll(benchmark::State& state) {
+  std::vector<std::string> patterns;
+  for (unsigned i = 0; i < 1024; ++i)
+    patterns.push_back("(kw" + std::to_string(i * 7919) + ")+(x|y.)");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(RGVM::CompileAll(patterns, state.range(0)));
+  state.SetItemsProcessed(state.iterations() * patterns.size());
+}
+BENCHMARK(BM_CompileAll)->Arg(1)->Arg(4)->UseRealTime();
+
+// 256 rules against 4096 log lines.
+void BM_MatchMatrix(benchmark::State& state) {
+  std::vector<RGVM::VM> vms(256);
+  std::vector<const RGVM::VM*> patterns;
+  for (unsigned i = 0; i < vms.size(); ++i) {
+    vms[i].Compile("user" + std::to_string(i * 37) + ".*(GET|POST)");
+    patterns.push_back(&vms[i]);
+  }
+  std::vector<std::string> lines;
+  for (unsigned i = 0; i < 4096; ++i)
+    lines.push_back(LogInput(96) + "user" + std::to_string(i) + " GET");
+  const std::vector<std::string_view> documents(lines.begin(), lines.end());
+  RGVM::MatrixOptions options;
+  options.num_threads = state.range(0);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(
+        RGVM::MatchMatrix(patterns, documents, options));
+  state.SetItemsProcessed(state.iterations() * patterns.size() *
+                          documents.size());
+}
+BENCHMARK(BM_MatchMatrix)->Arg(1)->Arg(4)->UseRealTime();
+
+// Bytes held per compiled rule, without and with a tight MemoryBudget.
+void BM_RuleFootprint(benchmark::State& state) {
+  RGVM::MemoryBudget budget;
+  if (state.range(0)) {
+    budget.retain_ast = false;
+    budget.max_accelerator_bytes = 1 << 10;
+    budget.max_scratch_bytes = 1 << 10;
+  }
+  RGVM::SetMemoryBudget(budget);
+  size_t bytes = 0;
+  std::vector<RGVM::VM> vms(1024);
+  for (auto _ : state) {
+    bytes = 0;
+    for (unsigned i = 0; i < vms.size(); ++i) {
+      vms[i].Compile("user" + std::to_string(i * 37) + ".*(GET|POST)(/x+)");
+      vms[i].Search(LogInput(256));
+      bytes += vms[i].MemoryUsage().Total();
+    }
+  }
+  RGVM::SetMemoryBudget({});
+  state.counters["bytes_per_rule"] = bytes / vms.size();
+}
+BENCHMARK(BM_RuleFootprint)->Arg(0)->Arg(1);
+
+void BM_Matches(benchmark::State& state, const std::string& regexp,
+                const std::string& input, bool jit = true) {
+  RGVM::VM vm;
+  vm.SetJit(jit);
+  if (!vm.Compile(regexp)) state.SkipWithError("compile failed");
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) benchmark::DoNotOptimize(vm.Matches(input));
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+
+void BM_SearchPathological(benchmark::State& state) {
+  const unsigned n = state.range(0);
+  BM_Search(state, PathologicalRegexp(n), Repeat("a", n));
+}
+BENCHMARK(BM_SearchPathological)->Range(2, 32);
+
+// Nested quantifiers over a subject that never matches.
+void BM_SearchNestedStar(benchmark::State& state) {
+  BM_Search(state, "(a*b)*c", Repeat("aab", state.range(0)));
+}
+BENCHMARK(BM_SearchNestedStar)->Range(16, 1 << 12);
+
+void BM_SearchLog(benchmark::State& state) {
+  BM_Search(state, kLogRegexp, LogInput(state.range(0)));
+}
+BENCHMARK(BM_SearchLog)->Range(1 << 10, 1 << 16);
+
+// The log in 4KB chunks.
+void BM_StreamLog(benchmark::State& state) {
+  RGVM::StreamMatcher matcher;
+  if (!matcher.Compile(kLogRegexp)) state.SkipWithError("compile failed");
+  const std::string input = LogInput(state.range(0));
+  std::vector<RGVM::StreamMatch> matches;
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    for (size_t i = 0; i < input.size(); i += 4096)
+      matcher.Feed(std::string_view(input).substr(i, 4096), &matches);
+    matcher.Finish(&matches);
+    matches.clear();
+  }
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_StreamLog)->Range(1 << 10, 1 << 16);
+
+// The log compressed into a temporary gzip file, decompressed and scanned on
+// two threads.
+void BM_ScanGzipLog(benchmark::State& state) {
+  RGVM::StreamMatcher matcher;
+  if (!matcher.Compile(kLogRegexp)) state.SkipWithError("compile failed");
+  const std::string input = LogInput(state.range(0));
+  // A file of its own, so that concurrent runs do not collide.
+  std::string path =
+      (std::filesystem::temp_directory_path() / "rgvm_bench_XXXXXX").string();
+  const int fd = mkstemp(path.data());
+  if (fd < 0) {
+    state.SkipWithError("cannot create the temporary file");
+    return;
+  }
+  gzFile file = gzdopen(fd, "wb");
+  const bool written =
+      file && gzwrite(file, input.data(), input.size()) ==
+                  static_cast<int>(input.size());
+  if (gzclose(file) != Z_OK || !written) {
+    std::remove(path.c_str());
+    state.SkipWithError("cannot write the temporary file");
+    return;
+  }
+  uint64_t matches = 0;
+  for (auto _ : state) {
+    if (!RGVM::ScanGzipFile(path, matcher,
+                            [&](const RGVM::StreamMatch&) { ++matches; })) {
+      state.SkipWithError("scan failed");
+      break;
+    }
+  }
+  std::remove(path.c_str());
+  benchmark::DoNotOptimize(matches);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_ScanGzipLog)->Range(1 << 16, 1 << 22)->UseRealTime();
+
+// One keystroke in the middle of the log per iteration.
+void BM_UpdateLog(benchmark::State& state) {
+  RGVM::IncrementalSearch incremental;
+  if (!incremental.Compile(kLogRegexp)) state.SkipWithError("compile failed");
+  std::string input = LogInput(state.range(0));
+  incremental.Search(input);
+  const unsigned offset = input.size() / 2;
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) {
+    input[offset] ^= 1;
+    benchmark::DoNotOptimize(incremental.Update(input, offset, 1, 1));
+  }
+  ReportAllocations(state, start);
+}
+BENCHMARK(BM_UpdateLog)->Range(1 << 10, 1 << 20);
+
+// Near misses of KeywordRegexp() everywhere, so that no prefilter can skip
+// the input.
+void BM_SearchKeywords(benchmark::State& state) {
+  std::string input;
+  for (unsigned i = 0; input.size() < (1 << 16); ++i)
+    input += "kw" + std::to_string(i * 7919) + "y ";
+  BM_Search(state, KeywordRegexp(state.range(0)), input);
+}
+BENCHMARK(BM_SearchKeywords)->Range(4, 4096);
+
+void BM_SearchCapture(benchmark::State& state) {
+  BM_Search(state, kCaptureRegexp, CaptureInput(state.range(0)));
+}
+BENCHMARK(BM_SearchCapture)->Range(1 << 10, 1 << 16);
+
+void BM_SearchCapturePike(benchmark::State& state) {
+  BM_Search(state, kCaptureRegexp, CaptureInput(state.range(0)),
+            RGVM::Engine::Pike);
+}
+BENCHMARK(BM_SearchCapturePike)->Range(1 << 10, 1 << 16);
+
+void BM_MatchesCapture(benchmark::State& state) {
+  BM_Matches(state, kCaptureRegexp, CaptureInput(state.range(0)));
+}
+BENCHMARK(BM_MatchesCapture)->Range(1 << 10, 1 << 16);
+
+void BM_MatchesCaptureInterpreter(benchmark::State& state) {
+  BM_Matches(state, kCaptureRegexp, CaptureInput(state.range(0)), false);
+}
+BENCHMARK(BM_MatchesCaptureInterpreter)->Range(1 << 10, 1 << 16);
+
+void BM_MatchesCaptureDfa(benchmark::State& state) {
+  RGVM::RegexPtr rp;
+  RGVM::Parse(kCaptureRegexp, rp);
+  const auto dfa = RGVM::Dfa::Build(RGVM::Compile(rp));
+  const std::string input = CaptureInput(state.range(0));
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) benchmark::DoNotOptimize(dfa->Matches(input));
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_MatchesCaptureDfa)->Range(1 << 10, 1 << 16);
+
+void BM_ReplaceAllCapture(benchmark::State& state) {
+  RGVM::VM vm;
+  RGVM::ReplaceTemplate replacement;
+  if (!vm.Compile(kCaptureRegexp) || !replacement.Compile("$5$4$3$2$1"))
+    state.SkipWithError("compile failed");
+  const std::string input = CaptureInput(state.range(0));
+  std::string out;
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(RGVM::ReplaceAll(vm, input, replacement, &out));
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_ReplaceAllCapture)->Range(1 << 10, 1 << 16);
+
+void BM_SearchCaptureStatic(benchmark::State& state) {
+  RGVM::StaticRegex<"(a+)(b+)(c+)(d+)(e+)"> regex;
+  const std::string input = CaptureInput(state.range(0));
+  const uint64_t start = g_allocations.load();
+  for (auto _ : state) benchmark::DoNotOptimize(regex.Search(input));
+  ReportAllocations(state, start);
+  state.SetBytesProcessed(state.iterations() * input.size());
+}
+BENCHMARK(BM_SearchCaptureStatic)->Range(1 << 10, 1 << 16);
+
+void BM_SearchCaptureTwoPass(benchmark::State& state) {
+  BM_Search(state, kCaptureRegexp, CaptureInput(state.range(0)),
+            RGVM::Engine::TwoPass);
+}
+BENCHMARK(BM_SearchCaptureTwoPass)->Range(1 << 10, 1 << 16);
+
+}  // namespace
+
+BENCHMARK_MAIN();
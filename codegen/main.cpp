@@ -0,0 +1,253 @@
+// Ahead-of-time compiler of rule files. Every rule is a line
+//
+//   Name regexp
+//
+// and becomes a class Name with the API of RGVM::VM::Search, a DirectVM. The
+// minimal DFA of the rule is emitted as a state machine, one label per state
+// and a switch over the next byte; it answers Matches(), and Search() runs it
+// first. Only the texts it accepts go through the program, also emitted as
+// code: a switch over the program counter with one case per instruction, run
+// as a Pike VM to recover the match and the captures. A rule whose DFA has
+// more than kMaxDfaStates states gets the program alone. Empty lines and
+// lines starting with '#' are skipped.
+//
+// Usage: codegen <rules> <output header> [namespace]
+
+#include <RGVM.h>
+#include <dfa.h>
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Bounds the code emitted for a DFA, about a switch per state.
+constexpr unsigned kMaxDfaStates = 1 << 10;
+
+struct Rule {
+  std::string name;
+  std::string regexp;
+  std::vector<RGVM::Instruction> program;
+  unsigned num_slots = 0;
+  // nullptr if the DFA has too many states.
+  std::unique_ptr<RGVM::Dfa> dfa;
+};
+
+bool IsIdentifier(const std::string& name) {
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+    return false;
+  for (char c : name)
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_') return false;
+  return true;
+}
+
+// Emits MatchesAny(), the same as Dfa::Matches() with every state a label
+// and every transition a goto.
+void EmitDfa(const RGVM::Dfa& dfa, std::ostream& out) {
+  out << "  static bool MatchesAny(std::string_view text) {\n"
+      << "    const char* p = text.data();\n"
+      << "    const char* const end = p + text.size();\n"
+      << "    goto s" << dfa.StartState() << ";\n";
+  for (unsigned state = 0; state < dfa.NumStates(); ++state) {
+    const char* accepting = dfa.Accepting(state) ? "true" : "false";
+    out << "  s" << state << ":\n";
+    // The most frequent next state is the default of the switch.
+    std::map<unsigned, unsigned> counts;
+    for (unsigned byte = 0; byte < 256; ++byte)
+      ++counts[dfa.NextState(state, byte)];
+    const unsigned fallback =
+        std::max_element(counts.begin(), counts.end(),
+                         [](const auto& a, const auto& b) {
+                           return a.second < b.second;
+                         })
+            ->first;
+    if (counts.size() == 1 && fallback == state) {
+      // Nothing left to read can change the answer.
+      out << "    return " << accepting << ";\n";
+      continue;
+    }
+    out << "    if (p == end) return " << accepting << ";\n";
+    if (counts.size() == 1) {
+      out << "    ++p;\n"
+          << "    goto s" << fallback << ";\n";
+      continue;
+    }
+    out << "    switch (static_cast<unsigned char>(*p++)) {\n";
+    for (unsigned byte = 0; byte < 256; ++byte) {
+      const unsigned next = dfa.NextState(state, byte);
+      if (next == fallback) continue;
+      out << "      case " << byte << ":";
+      // A trailing backslash would continue the comment.
+      if (std::isgraph(byte) && byte != '\\')
+        out << "  // " << static_cast<char>(byte);
+      out << "\n"
+          << "        goto s" << next << ";\n";
+    }
+    out << "      default:\n"
+        << "        goto s" << fallback << ";\n"
+        << "    }\n";
+  }
+  out << "  }\n\n";
+}
+
+// Emits the DirectVM program of |rule|.
+void EmitProgram(const Rule& rule, std::ostream& out) {
+  const auto& program = rule.program;
+  out << "// " << rule.regexp << "\n";
+  out << "struct " << rule.name << "Program {\n";
+  out << "  static constexpr unsigned kSize = " << program.size() << ";\n";
+  out << "  static constexpr unsigned kNumSlots = " << rule.num_slots << ";\n";
+  out << "  using Thread = RGVM::DirectThread<kNumSlots>;\n";
+  out << "  using ThreadList = RGVM::DirectThreadList<kSize, kNumSlots>;\n\n";
+
+  out << "  static void AddThread(ThreadList& list,\n"
+      << "                        [[maybe_unused]] bool greedy, unsigned pc,\n"
+      << "                        [[maybe_unused]] unsigned pos,\n"
+      << "                        Thread thread) {\n"
+      << "    for (;;) {\n"
+      << "      if (!list.Visit(pc)) return;\n"
+      << "      switch (pc) {\n";
+  for (unsigned pc = 0; pc < program.size(); ++pc) {
+    const auto& instruction = program[pc];
+    switch (instruction.opcode) {
+      case RGVM::Jmp:
+        out << "        case " << pc << ":  // JMP\n"
+            << "          pc = " << instruction.jmp << ";\n"
+            << "          break;\n";
+        break;
+      case RGVM::Split:
+        out << "        case " << pc << ":  // SPLIT\n"
+            << "          if (greedy) {\n"
+            << "            AddThread(list, greedy, " << instruction.x
+            << ", pos, thread);\n"
+            << "            pc = " << instruction.y << ";\n"
+            << "          } else {\n"
+            << "            AddThread(list, greedy, " << instruction.y
+            << ", pos, thread);\n"
+            << "            pc = " << instruction.x << ";\n"
+            << "          }\n"
+            << "          break;\n";
+        break;
+      case RGVM::Save:
+        out << "        case " << pc << ":  // SAVE\n"
+            << "          thread.Save(" << instruction.saved << ", pos);\n"
+            << "          pc = " << pc + 1 << ";\n"
+            << "          break;\n";
+        break;
+      default:
+        break;
+    }
+  }
+  out << "        default:  // CHAR, ANY and MATCH\n"
+      << "          list.Push(pc, thread);\n"
+      << "          return;\n"
+      << "      }\n"
+      << "    }\n"
+      << "  }\n\n";
+
+  if (rule.dfa) EmitDfa(*rule.dfa, out);
+
+  out << "  static bool Step(unsigned pc, std::string_view text, unsigned i,\n"
+      << "                   bool greedy, Thread& thread, ThreadList& next) {\n"
+      << "    switch (pc) {\n";
+  for (unsigned pc = 0; pc < program.size(); ++pc) {
+    const auto& instruction = program[pc];
+    switch (instruction.opcode) {
+      case RGVM::Char:
+      case RGVM::Any:
+        out << "      case " << pc << ":\n";
+        if (instruction.opcode == RGVM::Char) {
+          out << "        if (i < text.size() && text[i] == '" << instruction.c
+              << "') {\n";
+        } else {
+          out << "        if (i < text.size()) {\n";
+        }
+        out << "          ++thread.end;\n"
+            << "          AddThread(next, greedy, " << pc + 1
+            << ", i + 1, thread);\n"
+            << "        }\n"
+            << "        return false;\n";
+        break;
+      case RGVM::Match:
+        out << "      case " << pc << ":\n"
+            << "        return true;\n";
+        break;
+      default:
+        break;
+    }
+  }
+  out << "    }\n"
+      << "    return false;\n"
+      << "  }\n"
+      << "};\n\n";
+  out << "using " << rule.name << " = RGVM::DirectVM<" << rule.name
+      << "Program>;\n\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 3 || argc > 4) {
+    std::cerr << "usage: " << argv[0] << " <rules> <output header> [namespace]"
+              << std::endl;
+    return 1;
+  }
+  const std::string ns = argc == 4 ? argv[3] : "rules";
+
+  std::ifstream in(argv[1]);
+  if (!in) {
+    std::cerr << argv[1] << ": cannot open" << std::endl;
+    return 1;
+  }
+  std::vector<Rule> rules;
+  std::set<std::string> names;
+  std::string line;
+  for (unsigned n = 1; std::getline(in, line); ++n) {
+    std::istringstream fields(line);
+    Rule rule;
+    if (!(fields >> rule.name) || rule.name[0] == '#') continue;
+    std::getline(fields >> std::ws, rule.regexp);
+    RGVM::RegexPtr root;
+    if (!IsIdentifier(rule.name) || !RGVM::Parse(rule.regexp, root)) {
+      std::cerr << argv[1] << ":" << n << ": invalid rule: " << line
+                << std::endl;
+      return 1;
+    }
+    if (!names.insert(rule.name).second) {
+      std::cerr << argv[1] << ":" << n << ": duplicate rule name: " << rule.name
+                << std::endl;
+      return 1;
+    }
+    // Same program as VM::Compile().
+    root = RGVM::Simplify(root);
+    rule.program = RGVM::Compile(root);
+    rule.num_slots = 2 * RGVM::CountParens(root);
+    rule.dfa = RGVM::Dfa::Build(rule.program, kMaxDfaStates);
+    rules.push_back(std::move(rule));
+  }
+
+  std::ostringstream out;
+  out << "// Generated by codegen from " << argv[1] << ". Do not edit.\n\n"
+      << "#pragma once\n\n"
+      << "#include <string_view>\n\n"
+      << "#include \"direct_vm.h\"\n\n"
+      << "namespace " << ns << " {\n\n";
+  for (const auto& rule : rules) EmitProgram(rule, out);
+  out << "}  // namespace " << ns << "\n";
+
+  std::ofstream header(argv[2]);
+  header << out.str();
+  if (!header) {
+    std::cerr << argv[2] << ": cannot write" << std::endl;
+    return 1;
+  }
+  return 0;
+}
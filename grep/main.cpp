@@ -0,0 +1,358 @@
+// grep-like scanner, printing the lines of the input files that match any of
+// the patterns. A match never spans a newline. The files are mapped into
+// memory and scanned by a pool of threads; the output keeps the order of the
+// files.
+//
+// Usage: rgvm-grep [-rcob] [-j threads] (pattern | -f patterns) [path...]
+//   -f file  reads the patterns from |file|, one per line
+//   -r       walks the directories recursively
+//   -c       prints the number of matching lines of every file instead
+//   -o       prints every non-empty match instead of the lines
+//   -b       prefixes every output line with its byte offset in the file
+//   -j n     scans with |n| threads, one per hardware thread by default
+//
+// Reads the standard input if no path is given. Exits with 0 if some line
+// matched, 1 if none did and 2 on error.
+
+#include <RGVM.h>
+#include <bundle.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr char kStdin[] = "-";
+
+enum class Mode { Lines, Count, OnlyMatching };
+
+struct Options {
+  Mode mode = Mode::Lines;
+  bool byte_offset = false;
+  bool recursive = false;
+  unsigned num_threads = 0;
+  std::vector<std::string> patterns;
+  std::vector<std::string> paths;
+};
+
+void Usage() {
+  std::cerr << "Usage: rgvm-grep [-rcob] [-j threads] (pattern | -f patterns)"
+               " [path...]"
+            << std::endl;
+}
+
+void Error(const std::string& path, const std::string& message) {
+  std::cerr << "rgvm-grep: " << path << ": " << message << std::endl;
+}
+
+bool ReadPatterns(const std::string& path, std::vector<std::string>* patterns) {
+  std::ifstream in(path);
+  if (!in) return false;
+  for (std::string line; std::getline(in, line);)
+    if (!line.empty()) patterns->push_back(line);
+  return true;
+}
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+  bool patterns_given = false;
+  int i = 1;
+  for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+    const std::string_view arg = argv[i];
+    if (arg == "--") {
+      ++i;
+      break;
+    }
+    for (size_t j = 1; j < arg.size(); ++j) {
+      switch (arg[j]) {
+        case 'r':
+          options->recursive = true;
+          continue;
+        case 'c':
+          options->mode = Mode::Count;
+          continue;
+        case 'o':
+          options->mode = Mode::OnlyMatching;
+          continue;
+        case 'b':
+          options->byte_offset = true;
+          continue;
+        case 'f':
+        case 'j':
+          break;
+        default:
+          return false;
+      }
+      // The value is the rest of the argument, or the next one.
+      std::string value(arg.substr(j + 1));
+      if (value.empty()) {
+        if (++i == argc) return false;
+        value = argv[i];
+      }
+      if (arg[j] == 'j') {
+        options->num_threads = std::atoi(value.c_str());
+      } else {
+        if (!ReadPatterns(value, &options->patterns)) {
+          Error(value, std::strerror(errno));
+          return false;
+        }
+        patterns_given = true;
+      }
+      break;
+    }
+  }
+  if (!patterns_given) {
+    if (i == argc) return false;
+    options->patterns.push_back(argv[i++]);
+  }
+  options->paths.assign(argv + i, argv + argc);
+  if (options->paths.empty()) options->paths.push_back(kStdin);
+  return true;
+}
+
+// Read-only mapping of a whole file.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    if (data_) munmap(data_, size_);
+  }
+
+  // Sets errno on failure.
+  bool Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return false;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      close(fd);
+      errno = EISDIR;
+      return false;
+    }
+    size_ = st.st_size;
+    // mmap() rejects empty mappings.
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+      data_ = data;
+      madvise(data_, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+    return true;
+  }
+
+  std::string_view Data() const {
+    return {static_cast<const char*>(data_), size_};
+  }
+
+ private:
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Matches buffers line by line, with a VM of its own.
+class Scanner {
+ public:
+  Scanner(const Options& options, const std::string& regexp, bool show_names)
+      : options_(options), show_names_(show_names) {
+    // The lines are filtered with Matches(), which the JIT answers.
+    vm_.SetJit(true);
+    vm_.Compile(regexp);
+  }
+
+  // Appends the output for the lines of |text|, read from |name|, to |*out|.
+  // Returns whether some line matched.
+  bool Scan(const std::string& name, std::string_view text, std::string* out) {
+    const std::string& literal = vm_.Plan().prefix;
+    size_t matched_lines = 0;
+    for (size_t pos = 0; pos < text.size();) {
+      // Every match starts with the literal prefix of the plan, so the lines
+      // without it are skipped over. |pos| is always a line start.
+      size_t begin = pos;
+      if (!literal.empty()) {
+        const size_t found = text.find(literal, pos);
+        if (found == std::string_view::npos) break;
+        const size_t newline = text.rfind('\n', found);
+        begin = newline == std::string_view::npos ? 0 : newline + 1;
+      }
+      size_t end = text.find('\n', begin);
+      if (end == std::string_view::npos) end = text.size();
+      pos = end + 1;
+      const std::string_view line = text.substr(begin, end - begin);
+      if (!vm_.Matches(line)) continue;
+      ++matched_lines;
+      if (options_.mode == Mode::Lines) {
+        AppendPrefix(name, begin, out);
+        out->append(line).push_back('\n');
+      } else if (options_.mode == Mode::OnlyMatching) {
+        AppendMatches(name, line, begin, out);
+      }
+    }
+    if (options_.mode == Mode::Count) {
+      if (show_names_) out->append(name).push_back(':');
+      out->append(std::to_string(matched_lines)).push_back('\n');
+    }
+    return matched_lines > 0;
+  }
+
+ private:
+  void AppendPrefix(const std::string& name, size_t offset, std::string* out) {
+    if (show_names_) out->append(name).push_back(':');
+    if (options_.byte_offset)
+      out->append(std::to_string(offset)).push_back(':');
+  }
+
+  // Appends the matches of |line|, which starts at |offset| in the file, one
+  // after the other as ReplaceAll() finds them.
+  void AppendMatches(const std::string& name, std::string_view line,
+                     size_t offset, std::string* out) {
+    for (unsigned pos = 0;
+         pos < line.size() && vm_.SearchSpans(line.substr(pos));) {
+      const unsigned begin = pos + vm_.MatchSpan().begin;
+      const unsigned end = pos + vm_.MatchSpan().end;
+      if (end > begin) {
+        AppendPrefix(name, offset + begin, out);
+        out->append(line.substr(begin, end - begin)).push_back('\n');
+      }
+      pos = end > begin ? end : end + 1;
+    }
+  }
+
+  const Options& options_;
+  const bool show_names_;
+  RGVM::VM vm_;
+};
+
+// Expands the directories of |paths| into the files under them. Returns false
+// if some path could not be walked.
+bool ListFiles(const Options& options, std::vector<std::string>* files) {
+  namespace fs = std::filesystem;
+  bool ok = true;
+  for (const std::string& path : options.paths) {
+    std::error_code error;
+    if (!options.recursive || path == kStdin ||
+        !fs::is_directory(path, error)) {
+      files->push_back(path);
+      continue;
+    }
+    // Sorted, so that the output does not depend on the file system.
+    std::vector<std::string> found;
+    fs::recursive_directory_iterator it(
+        path, fs::directory_options::skip_permission_denied, error);
+    for (; !error && it != fs::recursive_directory_iterator();
+         it.increment(error)) {
+      if (it->is_regular_file(error)) found.push_back(it->path().string());
+    }
+    if (error) {
+      Error(path, error.message());
+      ok = false;
+    }
+    std::sort(found.begin(), found.end());
+    files->insert(files->end(), std::make_move_iterator(found.begin()),
+                  std::make_move_iterator(found.end()));
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options) || options.patterns.empty()) {
+    Usage();
+    return 2;
+  }
+
+  // The patterns are checked one by one, so that the error points at the
+  // culprit; the scanners then match them all at once.
+  const auto compiled = RGVM::CompileAll(options.patterns, options.num_threads);
+  std::string regexp;
+  for (size_t i = 0; i < compiled.size(); ++i) {
+    if (!compiled[i].ok) {
+      Error(options.patterns[i], compiled[i].error);
+      return 2;
+    }
+    if (i > 0) regexp.push_back('|');
+    regexp.append(options.patterns[i]);
+  }
+
+  std::vector<std::string> files;
+  bool ok = ListFiles(options, &files);
+  const bool show_names = options.recursive || files.size() > 1;
+  unsigned num_threads = options.num_threads;
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads =
+      std::max<size_t>(1, std::min<size_t>(num_threads, files.size()));
+
+  // The outputs are written in the order of the files: a worker done with a
+  // file flushes every output that is complete and not preceded by a pending
+  // one.
+  std::vector<std::string> outputs(files.size());
+  std::vector<bool> done(files.size());
+  size_t next_output = 0;
+  std::mutex output_mutex;
+  std::atomic<size_t> next_file{0};
+  std::atomic<bool> matched{false}, failed{false};
+  const auto work = [&] {
+    Scanner scanner(options, regexp, show_names);
+    for (size_t i = next_file++; i < files.size(); i = next_file++) {
+      std::string out;
+      if (files[i] == kStdin) {
+        const std::string text(std::istreambuf_iterator<char>(std::cin), {});
+        if (scanner.Scan("(standard input)", text, &out)) matched = true;
+      } else {
+        MappedFile file;
+        if (file.Open(files[i])) {
+          if (scanner.Scan(files[i], file.Data(), &out)) matched = true;
+        } else {
+          Error(files[i], std::strerror(errno));
+          failed = true;
+        }
+      }
+      std::lock_guard<std::mutex> lock(output_mutex);
+      outputs[i] = std::move(out);
+      done[i] = true;
+      for (; next_output < files.size() && done[next_output]; ++next_output) {
+        const std::string& output = outputs[next_output];
+        std::fwrite(output.data(), 1, output.size(), stdout);
+        outputs[next_output] = std::string();
+      }
+    }
+  };
+
+  // The calling thread is one of the workers.
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < num_threads; ++i) workers.emplace_back(work);
+  work();
+  for (auto& worker : workers) worker.join();
+  std::fflush(stdout);
+  if (failed) ok = false;
+  if (!ok) return 2;
+  return matched ? 0 : 1;
+}
@@ -4,66 +4,196 @@
 
 #include "RGVM.h"
 
-#include <queue>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <string>
 
 namespace RGVM {
 
 namespace {
 
+// State shared by the main loop and AddThread during one search. |stats| is
+// only touched when |kStats| is set and |limits| only when |kLimits| is set,
+// which keeps the instrumentation free when it is disabled.
+struct SearchContext {
+  const std::vector<Instruction>& instructions;
+  bool greedy;
+  SearchStats* stats;
+  const SearchLimits* limits;
+  // Bytes held by one thread with every capture slot filled.
+  uint64_t capture_bytes_per_thread = 0;
+  // Threads of the list AddThread is not filling, which count against the
+  // limits too.
+  size_t other_threads = 0;
+  uint64_t steps = 0;
+  SearchStatus status = SearchStatus::NoMatch;
+};
+
+// How many steps go by between two polls of the deadline and the cancellation
+// token.
+constexpr uint64_t kPollInterval = 1024;
+
+template <bool kStats>
+void CountThread(SearchContext& ctx, size_t alive) {
+  if constexpr (kStats) {
+    ++ctx.stats->total_threads;
+    if (alive > ctx.stats->peak_threads) ctx.stats->peak_threads = alive;
+  }
+}
+
+template <bool kStats>
+void CountInstruction(SearchContext& ctx, Opcode opcode) {
+  if constexpr (kStats) {
+    ++ctx.stats->instructions;
+    if (opcode == Split) ++ctx.stats->split_forks;
+    if (opcode == Save) ++ctx.stats->save_forks;
+  }
+}
+
+// Polls the deadline and the cancellation token. Returns false and records the
+// reason in |ctx.status| if the search must stop.
+bool PollLimits(SearchContext& ctx) {
+  const SearchLimits& limits = *ctx.limits;
+  if (limits.cancel && limits.cancel->load(std::memory_order_relaxed)) {
+    ctx.status = SearchStatus::Cancelled;
+    return false;
+  }
+  if (limits.deadline != std::chrono::steady_clock::time_point::max() &&
+      std::chrono::steady_clock::now() >= limits.deadline) {
+    ctx.status = SearchStatus::BudgetExceeded;
+    return false;
+  }
+  return true;
+}
+
+// Charges one step with |alive| live threads against the limits. Returns false
+// and records the reason in |ctx.status| if the search must stop.
+template <bool kLimits>
+bool CheckLimits(SearchContext& ctx, size_t alive) {
+  if constexpr (kLimits) {
+    const SearchLimits& limits = *ctx.limits;
+    ++ctx.steps;
+    if ((limits.max_steps && ctx.steps > limits.max_steps) ||
+        (limits.max_threads && alive > limits.max_threads) ||
+        (limits.max_capture_bytes &&
+         alive * ctx.capture_bytes_per_thread > limits.max_capture_bytes)) {
+      ctx.status = SearchStatus::BudgetExceeded;
+      return false;
+    }
+    if (ctx.steps % kPollInterval == 0) return PollLimits(ctx);
+  }
+  return true;
+}
+
 // See https://swtch.com/~rsc/regexp/regexp2.html "Ambiguous Submatching".
 //
 // TLDR: this recursive function mimics the behavior of backtrack implementation
 // who respect the thread order, which allows us to implement the greedy
-// matching.
-void AddThread(const std::vector<Instruction>& instructions,
-               std::string::const_iterator str_itr, bool greedy,
-               Thread&& thread, std::queue<Thread>& queue) {
-  queue.emplace(std::move(thread));
-  auto& t = queue.back();
-  const auto& instruction = instructions[t.pc];
+// matching. The thread and the whole closure reached from it are added to
+// |list| before any lower priority thread; |pos| is the string index the
+// threads are at.
+//
+// Returns false if the search ran out of budget.
+template <bool kStats, bool kLimits>
+bool AddThread(SearchContext& ctx, unsigned pos, Thread&& thread,
+               ThreadList& list) {
+  if (list.visited.Contains(thread.pc)) return true;
+  list.visited.Insert(thread.pc);
+  const auto& instruction = ctx.instructions[thread.pc];
+  CountInstruction<kStats>(ctx, instruction.opcode);
+  if (!CheckLimits<kLimits>(ctx, ctx.other_threads + list.threads.size()))
+    return false;
 
   switch (instruction.opcode) {
     case Jmp:
-      AddThread(instructions, str_itr, greedy, t.Fork(instruction.jmp), queue);
-      break;
+      thread.pc = instruction.jmp;
+      return AddThread<kStats, kLimits>(ctx, pos, std::move(thread), list);
 
-    case Split:
-      if (greedy) {
-        AddThread(instructions, str_itr, greedy, t.Fork(instruction.x), queue);
-        AddThread(instructions, str_itr, greedy, t.Fork(instruction.y), queue);
-      } else {
-        AddThread(instructions, str_itr, greedy, t.Fork(instruction.y), queue);
-        AddThread(instructions, str_itr, greedy, t.Fork(instruction.x), queue);
-      }
-      break;
+    case Split: {
+      const unsigned first = ctx.greedy ? instruction.x : instruction.y;
+      const unsigned second = ctx.greedy ? instruction.y : instruction.x;
+      if (!AddThread<kStats, kLimits>(ctx, pos, thread.Fork(first), list))
+        return false;
+      thread.pc = second;
+      return AddThread<kStats, kLimits>(ctx, pos, std::move(thread), list);
+    }
 
     case Save:
-      if (t.saved.size() <= instruction.saved)
-        t.saved.resize(instruction.saved + 1);
-      t.saved[instruction.saved] = str_itr;
-      AddThread(instructions, str_itr, greedy, t.Fork(t.pc + 1), queue);
-      break;
+      if (thread.saved.size() <= instruction.saved)
+        thread.saved.resize(instruction.saved + 1);
+      thread.saved[instruction.saved] = pos;
+      ++thread.pc;
+      return AddThread<kStats, kLimits>(ctx, pos, std::move(thread), list);
 
     // Handled in the main loop.
     case Char:
     case Any:
     case Match:
+      list.threads.emplace_back(std::move(thread));
+      CountThread<kStats>(ctx, list.threads.size());
       break;
     default:
       assert(false);
   }
+  return true;
 }
+
+std::atomic<bool> jit_by_default{false};
+
 }  // namespace
 
+void VM::SetJitByDefault(bool enable) {
+  jit_by_default.store(enable, std::memory_order_relaxed);
+}
+
+bool VM::JitByDefault() {
+  return jit_by_default.load(std::memory_order_relaxed);
+}
+
 bool VM::Compile(const std::string& regexp) {
   if (!RGVM::Parse(regexp, regex_root_)) return false;
+  std::vector<std::string> literals;
+  if (ExtractLiterals(regex_root_, &literals)) {
+    aho_corasick_ = std::make_unique<AhoCorasick>(literals);
+  } else {
+    aho_corasick_.reset();
+    literals.clear();
+  }
+  // The literals are extracted first: factoring turns the alternation into
+  // something ExtractLiterals does not recognize.
+  regex_root_ = Simplify(regex_root_);
   instructions_ = RGVM::Compile(regex_root_);
+  reverse_instructions_ = RGVM::CompileReverse(regex_root_);
+  plan_ = MakePlan(regex_root_, instructions_, literals.size());
+  // Aho-Corasick is faster still.
+  jit_.reset();
+  if (jit_enabled_ && !aho_corasick_)
+    jit_ = JitProgram::Compile(instructions_);
+  for (bool greedy : {false, true}) {
+    if (plan_.num_captures && !plan_.ambiguous) {
+      one_pass_[greedy] = std::make_unique<OnePass>(instructions_, greedy);
+    } else {
+      one_pass_[greedy].reset();
+    }
+  }
+  num_slots_ = 0;
+  for (const auto& instruction : instructions_)
+    if (instruction.opcode == Save && instruction.saved + 1 > num_slots_)
+      num_slots_ = instruction.saved + 1;
+
+  const MemoryBudget budget = GetMemoryBudget();
+  if (const size_t max = budget.max_accelerator_bytes) {
+    if (jit_ && jit_->MemoryUsage() > max) jit_.reset();
+    for (auto& one_pass : one_pass_)
+      if (one_pass && one_pass->MemoryUsage() > max) one_pass.reset();
+  }
+  if (!budget.retain_ast) regex_root_.reset();
   return true;
 }
 
-std::vector<std::string> VM::ConstructCaptures(const Thread& thread, bool ok) {
-  std::vector<std::string> captures;
+std::vector<Span> VM::ConstructCaptures(const Thread& thread, bool ok) {
+  std::vector<Span> captures;
   // Update the captured substrings if:
   // 1. !ok
   // 2. ok && current begin > thread begin (new substring starts earlier than
@@ -76,91 +206,257 @@ std::vector<std::string> VM::ConstructCaptures(const Thread& thread, bool ok) {
   }
   begin_ = thread.begin;
   end_ = thread.end;
-  for (unsigned j = 0; j < thread.saved.size(); j += 2) {
-    captures.emplace_back(thread.saved[j], thread.saved[j + 1]);
-  }
+  for (unsigned j = 0; j + 1 < thread.saved.size(); j += 2)
+    captures.push_back({thread.saved[j], thread.saved[j + 1]});
   return captures;
 }
 
-bool VM::Search(const std::string& target_string) {
-  std::queue<Thread> current;
+MemoryReport VM::MemoryUsage() const {
+  MemoryReport report;
+  report.ast = AstMemoryUsage(regex_root_);
+  report.program =
+      sizeof(*this) +
+      (instructions_.capacity() + reverse_instructions_.capacity()) *
+          sizeof(Instruction) +
+      plan_.prefix.capacity();
+  if (aho_corasick_) report.accelerators += aho_corasick_->MemoryUsage();
+  for (const auto& one_pass : one_pass_)
+    if (one_pass) report.accelerators += one_pass->MemoryUsage();
+  if (jit_) report.accelerators += jit_->MemoryUsage();
+  report.scratch = ScratchMemoryUsage();
+  report.captures = captures_.capacity() * sizeof(std::string) +
+                    capture_spans_.capacity() * sizeof(Span);
+  for (const std::string& capture : captures_) {
+    // Short captures live inside the std::string.
+    if (capture.capacity() >= sizeof(std::string))
+      report.captures += capture.capacity();
+  }
+  return report;
+}
+
+size_t VM::ScratchMemoryUsage() const {
+  return current_.MemoryUsage() + next_.MemoryUsage() +
+         scratch_.MemoryUsage() + one_pass_slots_.capacity() * sizeof(unsigned);
+}
+
+void VM::TrimScratch() {
+  const size_t max = GetMemoryBudget().max_scratch_bytes;
+  if (max == 0 || ScratchMemoryUsage() <= max) return;
+  current_ = ThreadList();
+  next_ = ThreadList();
+  scratch_ = ScanScratch();
+  one_pass_slots_ = std::vector<unsigned>();
+}
+
+bool VM::Search(std::string_view target_string) {
+  return SearchWithStats<false>(target_string, nullptr, true) ==
+         SearchStatus::Match;
+}
+
+SearchStatus VM::Search(std::string_view target_string,
+                        const SearchLimits& limits) {
+  return SearchWithStats<true>(target_string, &limits, true);
+}
+
+bool VM::SearchSpans(std::string_view target_string) {
+  return SearchWithStats<false>(target_string, nullptr, false) ==
+         SearchStatus::Match;
+}
+
+bool VM::Matches(std::string_view target_string) {
+  const bool matched = Matches(target_string, scratch_);
+  TrimScratch();
+  return matched;
+}
+
+bool VM::Matches(std::string_view target_string, ScanScratch& scratch) const {
+  if (aho_corasick_) return aho_corasick_->Matches(target_string);
+  if (jit_) return jit_->Matches(target_string);
+  return MatchesAny(instructions_, target_string, scratch);
+}
+
+template <bool kLimits>
+SearchStatus VM::SearchWithStats(std::string_view target_string,
+                                 const SearchLimits* limits,
+                                 bool copy_captures) {
+  captures_.clear();
+  capture_spans_.clear();
+  SearchStatus status;
+  if (!collect_stats_ && !stats_callback_) {
+    status = Dispatch<false, kLimits>(target_string, limits);
+  } else {
+    const auto start = std::chrono::steady_clock::now();
+    stats_ = SearchStats();
+    status = Dispatch<true, kLimits>(target_string, limits);
+    stats_.elapsed = std::chrono::steady_clock::now() - start;
+    if (stats_callback_) stats_callback_(stats_);
+  }
+  // The engines only record spans: the captures are copied once, from the
+  // winning thread.
+  if (status == SearchStatus::Match && copy_captures) {
+    for (const Span& span : capture_spans_) {
+      captures_.emplace_back(
+          target_string.substr(span.begin, span.end - span.begin));
+    }
+  }
+  TrimScratch();
+  return status;
+}
+
+template <bool kStats, bool kLimits>
+SearchStatus VM::Dispatch(std::string_view target_string,
+                          const SearchLimits* limits) {
+  if constexpr (kLimits) {
+    SearchContext ctx{instructions_, greedy_, &stats_, limits};
+    if (!PollLimits(ctx)) return ctx.status;
+  }
+
+  Engine engine = engine_;
+  if (engine == Engine::Auto ||
+      (engine == Engine::AhoCorasick && !aho_corasick_) ||
+      (engine == Engine::OnePass && !one_pass_[greedy_]))
+    engine = ChooseEngine(plan_, target_string.size());
+  // The memory budget may have dropped the OnePass tables.
+  if (engine == Engine::OnePass && !one_pass_[greedy_])
+    engine = Engine::TwoPass;
+  if (kLimits && (engine == Engine::TwoPass || engine == Engine::OnePass))
+    engine = Engine::Pike;
+  if constexpr (kStats) stats_.engine = engine;
+
+  if (engine == Engine::AhoCorasick) {
+    uint64_t skipped = 0;
+    if (!aho_corasick_->Search(target_string, greedy_, &begin_, &end_,
+                               &skipped))
+      return SearchStatus::NoMatch;
+    if constexpr (kStats) stats_.prefilter_skipped_bytes = skipped;
+    return SearchStatus::Match;
+  }
+
+  // No match can start before |from|.
+  unsigned from = 0;
+  const bool candidate = SkipToCandidate(plan_, target_string, &from);
+  if constexpr (kStats) {
+    stats_.prefilter_skipped_bytes =
+        candidate ? from : target_string.size();
+  }
+  if (!candidate) return SearchStatus::NoMatch;
+
+  if (engine == Engine::Pike) {
+    return SearchImpl<kStats, kLimits>(target_string, from,
+                                       target_string.size(), false, limits);
+  }
+
+  unsigned begin, end;
+  if (!FindMatchEnd(instructions_, target_string.substr(from), greedy_,
+                    scratch_, &end))
+    return SearchStatus::NoMatch;
+  end += from;
+  if (!FindMatchStart(reverse_instructions_, target_string, end, scratch_,
+                      &begin)) {
+    // Not reachable: the forward scan found a match ending at |end|.
+    assert(false);
+  }
+  if (num_slots_ == 0) {
+    begin_ = begin;
+    end_ = end;
+    return SearchStatus::Match;
+  }
+  if (engine == Engine::OnePass) {
+    Thread thread(0, begin, end, {});
+    if (!one_pass_[greedy_]->Search(target_string, begin, end,
+                                    one_pass_slots_, &thread.saved,
+                                    &thread.end)) {
+      // Not reachable: the scans found a match over [begin, end].
+      assert(false);
+    }
+    capture_spans_ = ConstructCaptures(thread, false);
+    return SearchStatus::Match;
+  }
+  return SearchImpl<kStats, kLimits>(target_string, begin, end, true, limits);
+}
+
+template <bool kStats, bool kLimits>
+SearchStatus VM::SearchImpl(std::string_view target_string, unsigned from,
+                            unsigned to, bool anchored,
+                            const SearchLimits* limits) {
+  SearchContext ctx{instructions_, greedy_, &stats_, limits};
+  if constexpr (kLimits) {
+    ctx.capture_bytes_per_thread = num_slots_ * sizeof(unsigned);
+    if (!PollLimits(ctx)) return ctx.status;
+  }
+
+  ThreadList* current = &current_;
+  ThreadList* next = &next_;
+  current->Reset(instructions_.size());
+  next->Reset(instructions_.size());
   bool ok = false;
 
   // <= because we need one extra iteration to complete all the threads in
-  // |current| queue.
-  for (unsigned i = 0; i <= target_string.size(); ++i) {
-    auto str_itr = (target_string.cbegin() + i);
-    std::queue<Thread> next;
-
-    if (i < target_string.size()) current.emplace(Thread(0, i, i, {}));
+  // |current| list.
+  for (unsigned i = from; i <= to; ++i) {
+    // A thread started now has the lowest priority; once there is a match it
+    // could never win.
+    if (!ok && i < target_string.size() && (!anchored || i == from)) {
+      ctx.other_threads = next->threads.size();
+      if (!AddThread<kStats, kLimits>(ctx, i, Thread(0, i, i, {}), *current)) {
+        capture_spans_.clear();
+        return ctx.status;
+      }
+    }
+    if (current->threads.empty() && (ok || anchored)) break;
 
-    while (!current.empty()) {
-      // Once we have found a match in the current queue, we can skip all the
-      // low priority threads in the queue.
-      bool matched = false;
-      auto& thread = current.front();
+    ctx.other_threads = current->threads.size();
 
+    for (auto& thread : current->threads) {
       const auto& instruction = instructions_[thread.pc];
+      CountInstruction<kStats>(ctx, instruction.opcode);
+      if (!CheckLimits<kLimits>(
+              ctx, current->threads.size() + next->threads.size())) {
+        capture_spans_.clear();
+        return ctx.status;
+      }
+
+      bool consumed = false;
       switch (instruction.opcode) {
         case Match: {
-          std::vector<std::string> temp = ConstructCaptures(thread, ok);
+          std::vector<Span> temp = ConstructCaptures(thread, ok);
 
           ok = true;
-          matched = true;
-          if (!temp.empty()) captures_ = std::move(temp);
+          if (!temp.empty()) capture_spans_ = std::move(temp);
 
           break;
         }
 
         case Char:
-          if (target_string[i] == instruction.c) {
-            ++thread.end;
-            next.emplace(thread.Fork(thread.pc + 1));
-          }
+          consumed = i < target_string.size() &&
+                     target_string[i] == instruction.c;
           break;
 
         case Any:
-          ++thread.end;
-          next.emplace(thread.Fork(thread.pc + 1));
-          break;
-
-        case Jmp:
-          AddThread(instructions_, str_itr, greedy_,
-                    thread.Fork(instruction.jmp), current);
-          break;
-
-        case Split:
-          if (greedy_) {
-            AddThread(instructions_, str_itr, greedy_,
-                      thread.Fork(instruction.x), current);
-            AddThread(instructions_, str_itr, greedy_,
-                      thread.Fork(instruction.y), current);
-          } else {
-            AddThread(instructions_, str_itr, greedy_,
-                      thread.Fork(instruction.y), current);
-            AddThread(instructions_, str_itr, greedy_,
-                      thread.Fork(instruction.x), current);
-          }
-          break;
-
-        case Save:
-          if (thread.saved.size() <= instruction.saved)
-            thread.saved.resize(instruction.saved + 1);
-          thread.saved[instruction.saved] = (target_string.cbegin() + i);
-          AddThread(instructions_, str_itr, greedy_, thread.Fork(thread.pc + 1),
-                    current);
+          consumed = i < target_string.size();
           break;
 
         default:
+          // Only CHAR, ANY and MATCH threads are queued by AddThread.
           assert(false);
       }
-      current.pop();
-      // Break out the while loop if current thread is a match.
-      if (matched) break;
-    }  // While
-    current = std::move(next);
-  }  // For
-  return ok;
+      // Once we have found a match in the current list, we can skip all the
+      // low priority threads in the list.
+      if (instruction.opcode == Match) break;
+      if (consumed) {
+        ++thread.end;
+        ++thread.pc;
+        if (!AddThread<kStats, kLimits>(ctx, i + 1, std::move(thread),
+                                        *next)) {
+          capture_spans_.clear();
+          return ctx.status;
+        }
+      }
+    }
+    std::swap(current, next);
+    next->Reset(instructions_.size());
+  }
+  return ok ? SearchStatus::Match : SearchStatus::NoMatch;
 }
 
 }  // namespace RGVM
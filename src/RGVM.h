@@ -5,23 +5,33 @@
 #ifndef RGVM_RGVM_H
 #define RGVM_RGVM_H
 
+#include <memory>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "aho_corasick.h"
+#include "budget.h"
 #include "instructions.h"
+#include "jit.h"
+#include "one_pass.h"
 #include "parser.h"
+#include "planner.h"
+#include "scan.h"
+#include "simplify.h"
+#include "span.h"
+#include "stats.h"
 
 namespace RGVM {
 
 struct Thread {
   unsigned pc = 0;
   unsigned begin = 0, end = 0;  // indices of the current substring.
-  std::vector<std::string::const_iterator>
-      saved;  // string indices of the capturing groups.
+  std::vector<unsigned> saved;  // string indices of the capturing groups.
 
   explicit Thread(unsigned pc) : pc(pc) {}
   Thread(unsigned pc, unsigned begin, unsigned end,
-         std::vector<std::string::const_iterator> saved)
+         std::vector<unsigned> saved)
       : pc(pc), begin(begin), end(end), saved(std::move(saved)) {}
   ~Thread() = default;
 
@@ -37,6 +47,26 @@ struct Thread {
   }
 };
 
+// Threads of one step of the VM, in priority order. |visited| holds every PC
+// reached during the step: a lower priority thread reaching a PC that is
+// already there can never win, and is dropped.
+struct ThreadList {
+  SparseSet visited;
+  std::vector<Thread> threads;
+
+  void Reset(unsigned program_size) {
+    visited.Reset(program_size);
+    threads.clear();
+  }
+
+  size_t MemoryUsage() const {
+    size_t size = visited.MemoryUsage() + threads.capacity() * sizeof(Thread);
+    for (const Thread& thread : threads)
+      size += thread.saved.capacity() * sizeof(unsigned);
+    return size;
+  }
+};
+
 class VM {
  public:
   VM() = default;
@@ -49,31 +79,155 @@ class VM {
   VM& operator=(VM&&) = default;
 
   // Creates the new VM, and compiles the input regular expression into
-  // instructions.
+  // instructions. Alternations of plain literals, e.g. "foo|bar|bazqux", are
+  // also compiled into an Aho-Corasick automaton that serves the searches.
+  // The pattern is analyzed into a SearchPlan, which picks the engine of every
+  // search.
   bool Compile(const std::string& regexp);
 
-  // Searches the target string against
-  bool Search(const std::string& target_string);
+  // Searches the target string against the compiled regexp. The match that
+  // starts leftmost wins; among those, the thread priority (greedy or not)
+  // decides.
+  bool Search(std::string_view target_string);
+
+  // Same as above, but gives up as soon as the search exceeds |limits| or is
+  // cancelled through |limits.cancel|. Captures() is empty after an aborted
+  // search.
+  SearchStatus Search(std::string_view target_string,
+                      const SearchLimits& limits);
+
+  // Same as Search(), but the captures are only recorded as spans into
+  // |target_string|, see CaptureSpans(): nothing is copied, and Captures() is
+  // left empty.
+  bool SearchSpans(std::string_view target_string);
+
+  // Returns whether |target_string| contains a match, without tracking
+  // captures or match boundaries: for callers that only need a boolean.
+  // Captures() and MatchSpan() are left untouched.
+  bool Matches(std::string_view target_string);
+
+  // Same as above, but safe to call concurrently on the same VM as long as
+  // every caller brings its own |scratch|.
+  bool Matches(std::string_view target_string, ScanScratch& scratch) const;
 
   void SetGreedy(bool greedy) { greedy_ = greedy; }
 
+  // Whether the next Compile() also translates the program into native code,
+  // see JitProgram. It then answers Matches(); the searches never run on it,
+  // since it yields neither spans nor captures. Disabled by default; a no-op
+  // unless the library is built with RGVM_ENABLE_JIT on x86-64, or if the
+  // program does not fit.
+  void SetJit(bool enable) { jit_enabled_ = enable; }
+
+  // Default of SetJit() for the VMs constructed afterwards, e.g. to run a
+  // whole program with the JIT on. Thread-safe.
+  static void SetJitByDefault(bool enable);
+
+  // Whether the last Compile() produced native code.
+  bool JitCompiled() const { return jit_ != nullptr; }
+
+  // Forces the engine of the searches instead of letting the plan pick one.
+  // All the engines give the same results:
+  // - Pike runs the capture tracking VM over the whole input;
+  // - TwoPass locates matches with a capture-free forward scan for the match
+  //   end and a reverse scan for its start, then only runs the capture
+  //   tracking VM over the match itself;
+  // - OnePass locates matches the same way, then runs the deterministic
+  //   OnePass executor over the match. Only applies to one-pass programs, and
+  //   only saves on capture extraction over TwoPass: the two scans still run
+  //   over the input;
+  // - AhoCorasick only applies to alternations of plain literals.
+  // An engine unable to serve the pattern falls back to Auto. Searches under
+  // SearchLimits never run on TwoPass, whose scans do not enforce them.
+  void SetEngine(Engine engine) { engine_ = engine; }
+
+  // Analysis of the compiled pattern. See PrintPlan().
+  const SearchPlan& Plan() const { return plan_; }
+
+  // Empty if the last search failed.
   const std::vector<std::string>& Captures() const { return captures_; }
 
+  // Boundaries of the captures of the last search in the searched string, in
+  // the same order as Captures(). Empty if the last search failed.
+  const std::vector<Span>& CaptureSpans() const { return capture_spans_; }
+
+  // Boundaries of the last match. Only meaningful if the last search
+  // succeeded.
+  Span MatchSpan() const { return {begin_, end_}; }
+
+  // Collects SearchStats on every search. Disabled by default, in which case
+  // the search loop carries no instrumentation at all.
+  void EnableStats(bool enable) { collect_stats_ = enable; }
+
+  // Invokes |callback| with the stats at the end of every search. Setting a
+  // callback enables stats collection; pass nullptr to remove it.
+  void SetStatsCallback(StatsCallback callback) {
+    stats_callback_ = std::move(callback);
+  }
+
+  // Stats of the last search. Only meaningful if stats are enabled.
+  const SearchStats& Stats() const { return stats_; }
+
+  // Bytes held by the VM, by component. See MemoryBudget to bound them.
+  MemoryReport MemoryUsage() const;
+
  private:
-  // Constructs captured strings from |target_string| and saves them into
-  // |captures_|.
-  std::vector<std::string> ConstructCaptures(const Thread& thread, bool ok);
+  // Copies the captures into |captures_| if |copy_captures|.
+  template <bool kLimits>
+  SearchStatus SearchWithStats(std::string_view target_string,
+                               const SearchLimits* limits, bool copy_captures);
+  template <bool kStats, bool kLimits>
+  SearchStatus Dispatch(std::string_view target_string,
+                        const SearchLimits* limits);
+  // Runs the capture tracking VM over target_string[from, to]. If |anchored|,
+  // only the matches starting at |from| are considered.
+  template <bool kStats, bool kLimits>
+  SearchStatus SearchImpl(std::string_view target_string, unsigned from,
+                          unsigned to, bool anchored,
+                          const SearchLimits* limits);
+
+  // Returns the spans captured by |thread| if its match replaces the one
+  // recorded so far, see the rules in RGVM.cpp; empty otherwise.
+  std::vector<Span> ConstructCaptures(const Thread& thread, bool ok);
+
+  size_t ScratchMemoryUsage() const;
+
+  // Releases the scratch memory if it exceeds MemoryBudget::max_scratch_bytes.
+  void TrimScratch();
+
+  // See SetJitByDefault().
+  static bool JitByDefault();
 
   bool greedy_ = true;
+  Engine engine_ = Engine::Auto;
   RegexPtr regex_root_;
+  SearchPlan plan_;
   std::vector<Instruction> instructions_;
+  std::vector<Instruction> reverse_instructions_;
+  // Number of SAVE slots used by |instructions_|.
+  unsigned num_slots_ = 0;
+  // Set if the regexp is an alternation of plain literals.
+  std::unique_ptr<AhoCorasick> aho_corasick_;
+  // Set if the program is one-pass and has captures. Indexed by greedy_.
+  std::unique_ptr<OnePass> one_pass_[2];
+  std::vector<unsigned> one_pass_slots_;
+  bool jit_enabled_ = JitByDefault();
+  std::unique_ptr<JitProgram> jit_;
   // Populated if the regexp contains capture.
   std::vector<std::string> captures_;
+  std::vector<Span> capture_spans_;
 
   // Record the current matched substring. Updated whenever a MATCH state is
   // reached.
   unsigned begin_ = 0;
   unsigned end_ = 0;
+
+  ThreadList current_, next_;
+  ScanScratch scratch_;
+
+  bool collect_stats_ = false;
+  StatsCallback stats_callback_;
+  SearchStats stats_;
 };
 
 }  // namespace RGVM
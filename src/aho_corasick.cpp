@@ -0,0 +1,189 @@
+#include "aho_corasick.h"
+
+#include <algorithm>
+#include <cassert>
+#include <queue>
+
+namespace RGVM {
+
+namespace {
+
+// Appends the literal spelled by the Concat chain rooted at |rp| to |literal|.
+bool ExtractLiteral(const RegexPtr& rp, std::string* literal) {
+  switch (rp->type) {
+    case Lit:
+      literal->push_back(rp->c);
+      return true;
+    case Concat:
+      return ExtractLiteral(rp->left, literal) &&
+             ExtractLiteral(rp->right, literal);
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+bool ExtractLiterals(const RegexPtr& rp, std::vector<std::string>* literals) {
+  if (rp == nullptr) return false;
+  if (rp->type == Alt) {
+    return ExtractLiterals(rp->left, literals) &&
+           ExtractLiterals(rp->right, literals);
+  }
+  literals->emplace_back();
+  return ExtractLiteral(rp, &literals->back());
+}
+
+size_t AhoCorasick::MemoryUsage() const {
+  size_t size = sizeof(*this) + literals_.capacity() * sizeof(std::string) +
+                transitions_.capacity() * sizeof(unsigned) +
+                outputs_.capacity() * sizeof(std::vector<unsigned>) +
+                output_links_.capacity() * sizeof(unsigned);
+  for (const std::string& literal : literals_) {
+    // Short literals live inside the std::string.
+    if (literal.capacity() >= sizeof(std::string)) size += literal.capacity();
+  }
+  for (const auto& output : outputs_)
+    size += output.capacity() * sizeof(unsigned);
+  return size;
+}
+
+AhoCorasick::AhoCorasick(const std::vector<std::string>& literals)
+    : literals_(literals) {
+  assert(!literals_.empty());
+  for (const auto& literal : literals_) {
+    assert(!literal.empty());
+    max_length_ = std::max<unsigned>(max_length_, literal.size());
+    first_byte_[static_cast<unsigned char>(literal[0])] = true;
+    for (char c : literal) {
+      auto& cls = byte_class_[static_cast<unsigned char>(c)];
+      if (cls == 0) cls = num_classes_++;
+    }
+  }
+
+  // Trie of the literals. kNone marks the missing edges.
+  std::vector<unsigned> trie(num_classes_, kNone);
+  outputs_.emplace_back();
+  for (unsigned id = 0; id < literals_.size(); ++id) {
+    unsigned state = 0;
+    for (char c : literals_[id]) {
+      const unsigned edge =
+          state * num_classes_ + byte_class_[static_cast<unsigned char>(c)];
+      if (trie[edge] == kNone) {
+        trie[edge] = num_states_++;
+        trie.resize(num_states_ * num_classes_, kNone);
+        outputs_.emplace_back();
+      }
+      state = trie[edge];
+    }
+    outputs_[state].push_back(id);
+  }
+
+  // Breadth first, so that the failure state of every state is complete by
+  // the time its children are visited. Missing edges are redirected to the
+  // failure state's transition, which turns the trie into a DFA.
+  transitions_ = std::move(trie);
+  output_links_.assign(num_states_, kNone);
+  std::vector<unsigned> failure(num_states_, 0);
+  std::queue<unsigned> queue;
+  for (unsigned cls = 0; cls < num_classes_; ++cls) {
+    unsigned& next = transitions_[cls];
+    if (next == kNone) {
+      next = 0;
+    } else {
+      queue.push(next);
+    }
+  }
+  while (!queue.empty()) {
+    const unsigned state = queue.front();
+    queue.pop();
+    const unsigned fail = failure[state];
+    output_links_[state] =
+        outputs_[fail].empty() ? output_links_[fail] : fail;
+    for (unsigned cls = 0; cls < num_classes_; ++cls) {
+      unsigned& next = transitions_[state * num_classes_ + cls];
+      const unsigned fallback = transitions_[fail * num_classes_ + cls];
+      if (next == kNone) {
+        next = fallback;
+      } else {
+        failure[next] = fallback;
+        queue.push(next);
+      }
+    }
+  }
+}
+
+unsigned AhoCorasick::SkipToCandidate(std::string_view text,
+                                      unsigned i) const {
+  while (i < text.size() && !first_byte_[static_cast<unsigned char>(text[i])])
+    ++i;
+  return i;
+}
+
+bool AhoCorasick::Matches(std::string_view text) const {
+  unsigned state = 0;
+  for (unsigned i = 0; i < text.size(); ++i) {
+    if (state == 0) {
+      i = SkipToCandidate(text, i);
+      if (i == text.size()) break;
+    }
+    state = Next(state, text[i]);
+    if (!outputs_[state].empty() || output_links_[state] != kNone) return true;
+  }
+  return false;
+}
+
+bool AhoCorasick::Search(std::string_view text, bool greedy, unsigned* begin,
+                         unsigned* end, uint64_t* skipped) const {
+  // Literals occurring at the leftmost start found so far.
+  unsigned best = kNone;
+  std::vector<unsigned> candidates;
+
+  unsigned state = 0;
+  for (unsigned i = 0; i < text.size(); ++i) {
+    if (state == 0) {
+      const unsigned from = i;
+      i = SkipToCandidate(text, i);
+      if (skipped) *skipped += i - from;
+      if (i == text.size()) break;
+    }
+    state = Next(state, text[i]);
+    for (unsigned s = outputs_[state].empty() ? output_links_[state] : state;
+         s != kNone; s = output_links_[s]) {
+      for (unsigned id : outputs_[s]) {
+        const unsigned start = i + 1 - literals_[id].size();
+        if (start < best) {
+          best = start;
+          candidates.clear();
+        }
+        if (start == best) candidates.push_back(id);
+      }
+    }
+    // Literals ending later all start after |best|.
+    if (best != kNone && i + 1 >= best + max_length_) break;
+  }
+  if (best == kNone) return false;
+
+  // Replays VM::Search on the threads started at |best|. At every step the
+  // highest priority literal ending there is recorded and cuts the lower
+  // priority ones, while the higher priority ones keep running.
+  const auto rank = [&](unsigned id) {
+    return greedy ? id : static_cast<unsigned>(literals_.size()) - 1 - id;
+  };
+  std::sort(candidates.begin(), candidates.end(),
+            [&](unsigned a, unsigned b) {
+              if (literals_[a].size() != literals_[b].size())
+                return literals_[a].size() < literals_[b].size();
+              return rank(a) < rank(b);
+            });
+  unsigned threshold = kNone;
+  for (unsigned id : candidates) {
+    if (rank(id) >= threshold) continue;
+    threshold = rank(id);
+    *end = best + literals_[id].size();
+  }
+  *begin = best;
+  return true;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,75 @@
+#ifndef RGVM_AHO_CORASICK_H
+#define RGVM_AHO_CORASICK_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "parser.h"
+
+namespace RGVM {
+
+// If the AST rooted at |rp| is an alternation of plain literals, e.g.
+// "foo|bar|bazqux", saves the literals into |literals| in alternation order
+// and returns true.
+bool ExtractLiterals(const RegexPtr& rp, std::vector<std::string>* literals);
+
+// Aho-Corasick automaton over a list of literals, compiled into a dense
+// transition table indexed by byte class: one table lookup per input byte, no
+// matter how many literals there are.
+class AhoCorasick {
+ public:
+  // |literals| must not be empty, nor contain the empty string.
+  explicit AhoCorasick(const std::vector<std::string>& literals);
+
+  AhoCorasick(const AhoCorasick&) = delete;
+  AhoCorasick& operator=(const AhoCorasick&) = delete;
+
+  // Returns whether any of the literals occurs in |text|.
+  bool Matches(std::string_view text) const;
+
+  // Finds the match VM::Search would report for the alternation of the
+  // literals: the leftmost one, and among those the one the thread priority
+  // picks. |skipped| is incremented by the number of bytes skipped without
+  // running the automaton. Returns false if there is no match.
+  bool Search(std::string_view text, bool greedy, unsigned* begin,
+              unsigned* end, uint64_t* skipped) const;
+
+  unsigned NumStates() const { return num_states_; }
+
+  // Bytes held by the automaton.
+  size_t MemoryUsage() const;
+
+ private:
+  static constexpr unsigned kNone = ~0u;
+
+  // Runs the automaton from position |i| in the start state; returns the
+  // position of the first byte that may start a literal.
+  unsigned SkipToCandidate(std::string_view text, unsigned i) const;
+
+  unsigned Next(unsigned state, char c) const {
+    return transitions_[state * num_classes_ +
+                        byte_class_[static_cast<unsigned char>(c)]];
+  }
+
+  std::vector<std::string> literals_;
+  unsigned max_length_ = 0;
+
+  // Bytes that never occur in a literal share class 0.
+  unsigned char byte_class_[256] = {};
+  // Whether a literal starts with the byte.
+  bool first_byte_[256] = {};
+  unsigned num_classes_ = 1;
+
+  unsigned num_states_ = 1;
+  std::vector<unsigned> transitions_;
+  // Literals ending at a state, and the closest state on the failure chain
+  // with some literal ending at it.
+  std::vector<std::vector<unsigned>> outputs_;
+  std::vector<unsigned> output_links_;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_AHO_CORASICK_H
@@ -0,0 +1,32 @@
+#include "budget.h"
+
+namespace RGVM {
+
+namespace {
+
+// Read on every compilation and search, hence one atomic per field rather
+// than a lock.
+std::atomic<bool> retain_ast{true};
+std::atomic<size_t> max_accelerator_bytes{0};
+std::atomic<size_t> max_scratch_bytes{0};
+
+}  // namespace
+
+void SetMemoryBudget(const MemoryBudget& budget) {
+  retain_ast.store(budget.retain_ast, std::memory_order_relaxed);
+  max_accelerator_bytes.store(budget.max_accelerator_bytes,
+                              std::memory_order_relaxed);
+  max_scratch_bytes.store(budget.max_scratch_bytes,
+                          std::memory_order_relaxed);
+}
+
+MemoryBudget GetMemoryBudget() {
+  MemoryBudget budget;
+  budget.retain_ast = retain_ast.load(std::memory_order_relaxed);
+  budget.max_accelerator_bytes =
+      max_accelerator_bytes.load(std::memory_order_relaxed);
+  budget.max_scratch_bytes = max_scratch_bytes.load(std::memory_order_relaxed);
+  return budget;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,68 @@
+#ifndef RGVM_BUDGET_H
+#define RGVM_BUDGET_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace RGVM {
+
+// Per-call resource limits of VM::Search. A zero limit means unlimited.
+struct SearchLimits {
+  // Instructions dispatched by the VM.
+  uint64_t max_steps = 0;
+  // Threads alive at the same time.
+  uint64_t max_threads = 0;
+  // Memory held by the capture slots of all live threads.
+  uint64_t max_capture_bytes = 0;
+  // Wall clock deadline, checked every few thousand steps.
+  std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::time_point::max();
+  // Cooperative cancellation: the search gives up as soon as it observes
+  // |*cancel| == true. Checked together with the deadline.
+  const std::atomic<bool>* cancel = nullptr;
+};
+
+// Outcome of a search run under SearchLimits.
+enum class SearchStatus { Match, NoMatch, BudgetExceeded, Cancelled };
+
+// Process-wide memory policy of the VMs, for processes loading many rules. A
+// zero limit means unlimited.
+struct MemoryBudget {
+  // Whether VM::Compile() keeps the AST of the pattern once compiled. Nothing
+  // needs it past compilation.
+  bool retain_ast = true;
+  // VM::Compile() drops the optional OnePass tables and native code larger
+  // than this; the searches then run on the other engines.
+  size_t max_accelerator_bytes = 0;
+  // A VM holding more scratch memory than this at the end of a search
+  // releases it, and grows it again on the next search.
+  size_t max_scratch_bytes = 0;
+};
+
+// Applies to the compilations and searches started afterwards. Thread-safe.
+void SetMemoryBudget(const MemoryBudget& budget);
+MemoryBudget GetMemoryBudget();
+
+// Bytes held by a VM, see VM::MemoryUsage().
+struct MemoryReport {
+  // AST of the pattern, if retained.
+  size_t ast = 0;
+  // The VM itself, its forward and reverse programs and its search plan.
+  size_t program = 0;
+  // Aho-Corasick automaton, OnePass tables and native code.
+  size_t accelerators = 0;
+  // Thread queues and scan memory kept between searches.
+  size_t scratch = 0;
+  // Captures of the last search.
+  size_t captures = 0;
+
+  size_t Total() const {
+    return ast + program + accelerators + scratch + captures;
+  }
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_BUDGET_H
@@ -0,0 +1,49 @@
+#include "bundle.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+
+namespace RGVM {
+
+namespace {
+
+// Describes where |pattern| stops being a valid regexp.
+std::string ParseError(const std::string& pattern) {
+  RegexPtr rp;
+  size_t offset = 0;
+  Parse(pattern, rp, &offset);
+  return "invalid regular expression at offset " + std::to_string(offset) +
+         ": \"" + pattern.substr(offset) + "\"";
+}
+
+}  // namespace
+
+std::vector<CompiledPattern> CompileAll(
+    const std::vector<std::string>& patterns, unsigned num_threads) {
+  std::vector<CompiledPattern> results(patterns.size());
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<size_t>(num_threads, patterns.size());
+
+  // The workers pull one pattern at a time, so that a few expensive patterns
+  // do not hold back a whole slice of the bundle.
+  std::atomic<size_t> next{0};
+  const auto work = [&] {
+    for (size_t i = next++; i < patterns.size(); i = next++) {
+      CompiledPattern& result = results[i];
+      result.ok = result.vm.Compile(patterns[i]);
+      if (!result.ok) result.error = ParseError(patterns[i]);
+    }
+  };
+
+  // The calling thread is one of the workers.
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < num_threads; ++i) workers.emplace_back(work);
+  work();
+  for (auto& worker : workers) worker.join();
+  return results;
+}
+
+}  // namespace RGVM
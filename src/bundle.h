@@ -0,0 +1,30 @@
+#ifndef RGVM_BUNDLE_H
+#define RGVM_BUNDLE_H
+
+#include <string>
+#include <vector>
+
+#include "RGVM.h"
+
+namespace RGVM {
+
+// Outcome of compiling one pattern of a bundle.
+struct CompiledPattern {
+  // Only meaningful if |ok|.
+  VM vm;
+  bool ok = false;
+  // Why the pattern was rejected, with the offset where parsing stopped and
+  // what is left of the pattern from there; empty if |ok|.
+  std::string error;
+};
+
+// Compiles every pattern of |patterns| into its own VM, as VM::Compile does,
+// spreading the patterns over |num_threads| worker threads, or one per
+// hardware thread if 0. The results are in input order, and a pattern that
+// fails to compile does not stop the others.
+std::vector<CompiledPattern> CompileAll(
+    const std::vector<std::string>& patterns, unsigned num_threads = 0);
+
+}  // namespace RGVM
+
+#endif  // RGVM_BUNDLE_H
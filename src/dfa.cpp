@@ -0,0 +1,327 @@
+#include "dfa.h"
+
+#include <algorithm>
+#include <map>
+#include <utility>
+
+#include "scan.h"
+
+namespace RGVM {
+
+namespace {
+
+constexpr char kMagic[] = "RGVMDFA1";
+constexpr size_t kMagicSize = sizeof(kMagic) - 1;
+constexpr size_t kHeaderSize = kMagicSize + 3 * 4 + 256 + 1;
+
+// Bytes taken by a state number in the exported tables.
+unsigned StateWidth(unsigned num_states) {
+  if (num_states <= 1u << 8) return 1;
+  if (num_states <= 1u << 16) return 2;
+  return 4;
+}
+
+void PutInt(std::string* out, uint32_t value, unsigned width) {
+  for (unsigned i = 0; i < width; ++i) out->push_back(value >> (8 * i));
+}
+
+uint32_t GetInt(std::string_view in, size_t* pos, unsigned width) {
+  uint32_t value = 0;
+  for (unsigned i = 0; i < width; ++i)
+    value |= uint32_t{static_cast<unsigned char>(in[(*pos)++])} << (8 * i);
+  return value;
+}
+
+// Hopcroft's algorithm: refines the partition {accepting, rejecting} until
+// the states of every block agree on the block each class leads to. Saves the
+// block of every state into |block_of| and returns the number of blocks.
+unsigned Minimize(unsigned num_states, unsigned num_classes,
+                  const std::vector<uint32_t>& table,
+                  const std::vector<uint8_t>& accepting,
+                  std::vector<unsigned>* block_of) {
+  // Predecessors of every (state, class) pair.
+  std::vector<unsigned> offsets(num_states * num_classes + 1, 0);
+  for (unsigned edge = 0; edge < table.size(); ++edge)
+    ++offsets[table[edge] * num_classes + edge % num_classes + 1];
+  for (unsigned i = 1; i < offsets.size(); ++i) offsets[i] += offsets[i - 1];
+  std::vector<unsigned> predecessors(table.size());
+  std::vector<unsigned> cursor(offsets.begin(), offsets.end() - 1);
+  for (unsigned edge = 0; edge < table.size(); ++edge) {
+    const unsigned target = table[edge] * num_classes + edge % num_classes;
+    predecessors[cursor[target]++] = edge / num_classes;
+  }
+
+  std::vector<std::vector<unsigned>> blocks(2);
+  block_of->assign(num_states, 0);
+  for (unsigned state = 0; state < num_states; ++state) {
+    (*block_of)[state] = accepting[state];
+    blocks[accepting[state]].push_back(state);
+  }
+  if (blocks[1].empty() || blocks[0].empty()) {
+    block_of->assign(num_states, 0);
+    return 1;
+  }
+
+  // Splitting by the smaller block is enough: splitting by the other one
+  // tells the same states apart.
+  std::vector<unsigned> work = {blocks[0].size() <= blocks[1].size() ? 0u : 1u};
+  std::vector<uint8_t> in_work = {work[0] == 0, work[0] == 1};
+  std::vector<unsigned> marked_count(2, 0);
+  std::vector<uint8_t> marked(num_states, 0);
+  std::vector<unsigned> marked_states, touched;
+  while (!work.empty()) {
+    const unsigned splitter = work.back();
+    work.pop_back();
+    in_work[splitter] = false;
+    const std::vector<unsigned> members = blocks[splitter];
+    for (unsigned cls = 0; cls < num_classes; ++cls) {
+      // Marks the states going to the splitter on |cls|.
+      for (unsigned state : members) {
+        const unsigned target = state * num_classes + cls;
+        for (unsigned i = offsets[target]; i < offsets[target + 1]; ++i) {
+          const unsigned p = predecessors[i];
+          if (marked[p]) continue;
+          marked[p] = true;
+          marked_states.push_back(p);
+          if (marked_count[(*block_of)[p]]++ == 0)
+            touched.push_back((*block_of)[p]);
+        }
+      }
+      // Splits the blocks with both marked and unmarked states.
+      for (unsigned block : touched) {
+        if (marked_count[block] < blocks[block].size()) {
+          std::vector<unsigned> in, out;
+          for (unsigned state : blocks[block])
+            (marked[state] ? in : out).push_back(state);
+          const unsigned added = blocks.size();
+          for (unsigned state : in) (*block_of)[state] = added;
+          blocks[block] = std::move(out);
+          blocks.push_back(std::move(in));
+          in_work.push_back(false);
+          marked_count.push_back(0);
+          unsigned next = added;
+          if (!in_work[block] && blocks[block].size() < blocks[added].size())
+            next = block;
+          work.push_back(next);
+          in_work[next] = true;
+        }
+        marked_count[block] = 0;
+      }
+      for (unsigned state : marked_states) marked[state] = false;
+      marked_states.clear();
+      touched.clear();
+    }
+  }
+  return blocks.size();
+}
+
+}  // namespace
+
+std::unique_ptr<Dfa> Dfa::Build(const std::vector<Instruction>& program,
+                                unsigned max_states) {
+  const unsigned match_pc = program.size() - 1;
+
+  // Every byte a CHAR tests gets a class of its own; all the other bytes
+  // share one, since only ANY consumes them.
+  unsigned char byte_class[256] = {};
+  bool tested[256] = {};
+  for (const auto& instruction : program) {
+    if (instruction.opcode == Char)
+      tested[static_cast<unsigned char>(instruction.c)] = true;
+  }
+  std::vector<unsigned char> representatives;
+  unsigned others = kNone;
+  for (unsigned byte = 0; byte < 256; ++byte) {
+    if (tested[byte] || others == kNone) {
+      if (!tested[byte]) others = representatives.size();
+      byte_class[byte] = representatives.size();
+      representatives.push_back(byte);
+    } else {
+      byte_class[byte] = others;
+    }
+  }
+  const unsigned num_classes = representatives.size();
+
+  // Subset construction. A state is the sorted set of the CHAR, ANY and MATCH
+  // reached by the threads, and the threads started at every position are
+  // added before the next byte is consumed, as in MatchesAny().
+  std::map<std::vector<unsigned>, unsigned> ids;
+  std::vector<std::vector<unsigned>> sets;
+  std::vector<uint32_t> table;
+  std::vector<uint8_t> accepting;
+  const auto state_of = [&](const SparseSet& set) {
+    std::vector<unsigned> key;
+    for (unsigned pc : set) {
+      const Opcode opcode = program[pc].opcode;
+      if (opcode == Char || opcode == Any || opcode == Match)
+        key.push_back(pc);
+    }
+    std::sort(key.begin(), key.end());
+    const auto [it, inserted] = ids.emplace(std::move(key), sets.size());
+    if (inserted) sets.push_back(it->first);
+    return it->second;
+  };
+
+  ScanScratch scratch;
+  scratch.Reset(program.size());
+  SparseSet& current = scratch.current;
+  SparseSet& next = scratch.next;
+  current.Clear();
+  const unsigned start = state_of(current);
+  for (unsigned state = 0; state < sets.size(); ++state) {
+    if (sets.size() > max_states) return nullptr;
+    current.Clear();
+    for (unsigned pc : sets[state]) current.Insert(pc);
+    accepting.push_back(current.Contains(match_pc));
+    AddClosure(program, 0, true, current, scratch.stack);
+
+    if (current.Contains(match_pc)) {
+      // Matched before the next byte: every text going through the state
+      // matches.
+      next.Clear();
+      next.Insert(match_pc);
+      table.insert(table.end(), num_classes, state_of(next));
+      continue;
+    }
+    for (unsigned cls = 0; cls < num_classes; ++cls) {
+      const char c = representatives[cls];
+      next.Clear();
+      for (unsigned pc : current) {
+        const auto& instruction = program[pc];
+        if (instruction.opcode == Any ||
+            (instruction.opcode == Char && instruction.c == c)) {
+          AddClosure(program, pc + 1, true, next, scratch.stack);
+        }
+      }
+      table.push_back(state_of(next));
+    }
+  }
+  if (sets.size() > max_states) return nullptr;
+
+  std::vector<unsigned> block_of;
+  const unsigned num_blocks =
+      Minimize(sets.size(), num_classes, table, accepting, &block_of);
+
+  // One state per block, taking the transitions of any of its states.
+  std::vector<unsigned> representative(num_blocks);
+  for (unsigned state = sets.size(); state-- > 0;)
+    representative[block_of[state]] = state;
+  std::vector<uint32_t> minimal(num_blocks * num_classes);
+  for (unsigned block = 0; block < num_blocks; ++block) {
+    for (unsigned cls = 0; cls < num_classes; ++cls) {
+      minimal[block * num_classes + cls] =
+          block_of[table[representative[block] * num_classes + cls]];
+    }
+  }
+
+  // Classes leading to the same states everywhere are merged.
+  std::map<std::vector<uint32_t>, unsigned> columns;
+  std::vector<unsigned> class_of(num_classes);
+  for (unsigned cls = 0; cls < num_classes; ++cls) {
+    std::vector<uint32_t> column(num_blocks);
+    for (unsigned block = 0; block < num_blocks; ++block)
+      column[block] = minimal[block * num_classes + cls];
+    class_of[cls] = columns.emplace(std::move(column), columns.size())
+                        .first->second;
+  }
+
+  std::unique_ptr<Dfa> dfa(new Dfa());
+  dfa->num_states_ = num_blocks;
+  dfa->num_classes_ = columns.size();
+  dfa->start_ = block_of[start];
+  for (unsigned byte = 0; byte < 256; ++byte)
+    dfa->byte_class_[byte] = class_of[byte_class[byte]];
+  dfa->transitions_.resize(num_blocks * dfa->num_classes_);
+  for (unsigned block = 0; block < num_blocks; ++block) {
+    for (unsigned cls = 0; cls < num_classes; ++cls) {
+      dfa->transitions_[block * dfa->num_classes_ + class_of[cls]] =
+          minimal[block * num_classes + cls];
+    }
+  }
+  dfa->accepting_.resize(num_blocks);
+  for (unsigned block = 0; block < num_blocks; ++block)
+    dfa->accepting_[block] = accepting[representative[block]];
+  dfa->Finish();
+  return dfa;
+}
+
+void Dfa::Finish() {
+  for (unsigned state = 0; state < num_states_ && matched_ == kNone;
+       ++state) {
+    if (!accepting_[state]) continue;
+    const auto row = transitions_.begin() + state * num_classes_;
+    if (std::all_of(row, row + num_classes_,
+                    [&](uint32_t next) { return next == state; }))
+      matched_ = state * num_classes_;
+  }
+  for (auto& next : transitions_) next *= num_classes_;
+  start_ *= num_classes_;
+}
+
+bool Dfa::Matches(std::string_view text) const {
+  const uint32_t* transitions = transitions_.data();
+  unsigned state = start_;
+  for (char c : text) {
+    state = transitions[state + byte_class_[static_cast<unsigned char>(c)]];
+    if (state == matched_) return true;
+  }
+  return accepting_[state / num_classes_];
+}
+
+std::string Dfa::Export() const {
+  const unsigned width = StateWidth(num_states_);
+  std::string out(kMagic, kMagicSize);
+  PutInt(&out, num_states_, 4);
+  PutInt(&out, num_classes_, 4);
+  PutInt(&out, start_ / num_classes_, 4);
+  out.append(reinterpret_cast<const char*>(byte_class_), 256);
+  out.push_back(width);
+  for (unsigned state = 0; state < num_states_; state += 8) {
+    unsigned char bits = 0;
+    for (unsigned i = 0; i < 8 && state + i < num_states_; ++i)
+      bits |= accepting_[state + i] << i;
+    out.push_back(bits);
+  }
+  for (uint32_t next : transitions_) PutInt(&out, next / num_classes_, width);
+  return out;
+}
+
+std::unique_ptr<Dfa> Dfa::Import(std::string_view tables) {
+  if (tables.size() < kHeaderSize ||
+      tables.substr(0, kMagicSize) != std::string_view(kMagic, kMagicSize))
+    return nullptr;
+  size_t pos = kMagicSize;
+  std::unique_ptr<Dfa> dfa(new Dfa());
+  dfa->num_states_ = GetInt(tables, &pos, 4);
+  dfa->num_classes_ = GetInt(tables, &pos, 4);
+  dfa->start_ = GetInt(tables, &pos, 4);
+  const unsigned num_states = dfa->num_states_;
+  const unsigned num_classes = dfa->num_classes_;
+  if (num_states == 0 || num_states > 1u << 24 || num_classes == 0 ||
+      num_classes > 256 || dfa->start_ >= num_states)
+    return nullptr;
+  for (unsigned byte = 0; byte < 256; ++byte) {
+    dfa->byte_class_[byte] = tables[pos++];
+    if (dfa->byte_class_[byte] >= num_classes) return nullptr;
+  }
+  const unsigned width = static_cast<unsigned char>(tables[pos++]);
+  const size_t num_transitions = size_t{num_states} * num_classes;
+  if (width != StateWidth(num_states) ||
+      tables.size() !=
+          pos + (num_states + 7) / 8 + num_transitions * width)
+    return nullptr;
+
+  dfa->accepting_.resize(num_states);
+  for (unsigned state = 0; state < num_states; ++state)
+    dfa->accepting_[state] = tables[pos + state / 8] >> (state % 8) & 1;
+  pos += (num_states + 7) / 8;
+  dfa->transitions_.resize(num_transitions);
+  for (auto& next : dfa->transitions_) {
+    next = GetInt(tables, &pos, width);
+    if (next >= num_states) return nullptr;
+  }
+  dfa->Finish();
+  return dfa;
+}
+
+}  // namespace RGVM
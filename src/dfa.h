@@ -0,0 +1,83 @@
+#ifndef RGVM_DFA_H
+#define RGVM_DFA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "instructions.h"
+
+namespace RGVM {
+
+// Complete, minimal DFA answering whether a text contains a match of a
+// program, i.e. the same as MatchesAny(). Built ahead of time: the subset
+// construction explores every state up front, Hopcroft's algorithm minimizes
+// them, and the bytes no transition tells apart share a byte class. Matching
+// is one table lookup per byte and never allocates.
+class Dfa {
+ public:
+  static constexpr unsigned kMaxStates = 1 << 16;
+
+  // Returns nullptr if the subset construction exceeds |max_states| states.
+  static std::unique_ptr<Dfa> Build(const std::vector<Instruction>& program,
+                                    unsigned max_states = kMaxStates);
+
+  // Returns nullptr if |tables| is not the output of a valid Export().
+  static std::unique_ptr<Dfa> Import(std::string_view tables);
+
+  Dfa(const Dfa&) = delete;
+  Dfa& operator=(const Dfa&) = delete;
+
+  bool Matches(std::string_view text) const;
+
+  // Serializes the tables into a compact, portable byte string: state
+  // numbers take 1, 2 or 4 bytes depending on the number of states.
+  std::string Export() const;
+
+  unsigned NumStates() const { return num_states_; }
+  unsigned NumClasses() const { return num_classes_; }
+
+  // The states, numbered from 0 to NumStates() - 1, e.g. to emit them as
+  // code. Matches() returns whether the state reached at the end of the text
+  // is accepting.
+  unsigned StartState() const { return start_ / num_classes_; }
+  unsigned NextState(unsigned state, unsigned char byte) const {
+    return transitions_[state * num_classes_ + byte_class_[byte]] /
+           num_classes_;
+  }
+  bool Accepting(unsigned state) const { return accepting_[state]; }
+
+  // Bytes held by the tables, which only depends on the two numbers above.
+  size_t MemoryUsage() const {
+    return sizeof(*this) + transitions_.size() * sizeof(transitions_[0]) +
+           accepting_.size();
+  }
+
+ private:
+  static constexpr unsigned kNone = ~0u;
+
+  Dfa() = default;
+
+  // Finds |matched_| and premultiplies the states of |transitions_| by
+  // |num_classes_|, once the tables are complete.
+  void Finish();
+
+  unsigned num_states_ = 0;
+  unsigned num_classes_ = 0;
+  unsigned start_ = 0;
+  unsigned char byte_class_[256] = {};
+  // Indexed by state * num_classes_ + class; the states are premultiplied.
+  std::vector<uint32_t> transitions_;
+  // Whether the text read so far contains a match, indexed by state.
+  std::vector<uint8_t> accepting_;
+  // Premultiplied accepting state looping on every byte, kNone if none: once
+  // reached, the rest of the text is irrelevant.
+  unsigned matched_ = kNone;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_DFA_H
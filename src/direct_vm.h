@@ -0,0 +1,182 @@
+#ifndef RGVM_DIRECT_VM_H
+#define RGVM_DIRECT_VM_H
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "span.h"
+
+namespace RGVM {
+
+// Thread of a DirectVM. Like the slots of a VM thread, |saved| logically
+// grows up to the highest slot written so far, |num_saved|.
+template <unsigned kNumSlots>
+struct DirectThread {
+  unsigned begin = 0, end = 0;
+  unsigned num_saved = 0;
+  std::array<unsigned, kNumSlots> saved{};
+
+  void Save(unsigned slot, unsigned pos) {
+    saved[slot] = pos;
+    num_saved = std::max(num_saved, slot + 1);
+  }
+};
+
+// Threads of one step of a DirectVM, in priority order, and the PCs visited
+// by the step. No allocation: there is at most one thread per PC.
+template <unsigned kSize, unsigned kNumSlots>
+struct DirectThreadList {
+  unsigned pcs[kSize] = {};
+  DirectThread<kNumSlots> threads[kSize] = {};
+  unsigned size = 0;
+  unsigned visited[kSize] = {};
+  unsigned generation = 1;
+
+  void Clear() {
+    size = 0;
+    // When |generation| wraps, the old marks could match it again.
+    if (++generation == 0) {
+      std::fill(std::begin(visited), std::end(visited), 0u);
+      generation = 1;
+    }
+  }
+
+  // Returns false if |pc| was already visited.
+  bool Visit(unsigned pc) {
+    if (visited[pc] == generation) return false;
+    visited[pc] = generation;
+    return true;
+  }
+
+  void Push(unsigned pc, const DirectThread<kNumSlots>& thread) {
+    pcs[size] = pc;
+    threads[size++] = thread;
+  }
+};
+
+// Pike VM whose instructions are code rather than data: |Program| provides
+//
+//   static constexpr unsigned kSize, kNumSlots;
+//   using Thread = DirectThread<kNumSlots>;
+//   using ThreadList = DirectThreadList<kSize, kNumSlots>;
+//   // Same as AddThread() in RGVM.cpp.
+//   static void AddThread(ThreadList& list, bool greedy, unsigned pc,
+//                         unsigned pos, Thread thread);
+//   // Runs the thread at the CHAR, ANY or MATCH |pc| over text[i]; returns
+//   // true on MATCH.
+//   static bool Step(unsigned pc, std::string_view text, unsigned i,
+//                    bool greedy, Thread& thread, ThreadList& next);
+//
+// and optionally a state machine answering the same as VM::Matches(), such as
+// a direct-coded DFA:
+//
+//   static bool MatchesAny(std::string_view text);
+//
+// Matches() then only runs the state machine, and Search() only runs the
+// threads, to recover the match and its captures, over the texts it accepts.
+//
+// Same semantics and API as VM::Search. See StaticRegex and the codegen tool.
+template <typename Program>
+class DirectVM {
+  using Thread = typename Program::Thread;
+  using ThreadList = typename Program::ThreadList;
+
+  static constexpr bool kHasMatchesAny = requires(std::string_view text) {
+    { Program::MatchesAny(text) } -> std::same_as<bool>;
+  };
+
+ public:
+  // Number of instructions of the program.
+  static constexpr unsigned kProgramSize = Program::kSize;
+
+  void SetGreedy(bool greedy) { greedy_ = greedy; }
+
+  // Same as VM::Search().
+  bool Search(std::string_view target_string) {
+    captures_.clear();
+    if constexpr (kHasMatchesAny) {
+      if (!Program::MatchesAny(target_string)) return false;
+    }
+    return Run<true>(target_string);
+  }
+
+  // Same as VM::Matches(): Captures() and MatchSpan() are left untouched.
+  bool Matches(std::string_view target_string) {
+    if constexpr (kHasMatchesAny) {
+      return Program::MatchesAny(target_string);
+    } else {
+      return Run<false>(target_string);
+    }
+  }
+
+  const std::vector<std::string>& Captures() const { return captures_; }
+
+  Span MatchSpan() const { return {begin_, end_}; }
+
+ private:
+  // Same as VM::ConstructCaptures().
+  void Record(std::string_view target_string, const Thread& thread, bool ok) {
+    if (ok) {
+      if (begin_ < thread.begin) return;
+      if (begin_ == thread.begin && end_ >= thread.end) return;
+    }
+    begin_ = thread.begin;
+    end_ = thread.end;
+    if (thread.num_saved < 2) return;
+    captures_.clear();
+    for (unsigned j = 0; j + 1 < thread.num_saved; j += 2) {
+      captures_.emplace_back(target_string.substr(
+          thread.saved[j], thread.saved[j + 1] - thread.saved[j]));
+    }
+  }
+
+  // Same main loop as VM::SearchImpl(). Without |kCaptures|, returns at the
+  // first match.
+  template <bool kCaptures>
+  bool Run(std::string_view target_string) {
+    ThreadList* current = &lists_[0];
+    ThreadList* next = &lists_[1];
+    current->Clear();
+    next->Clear();
+    bool ok = false;
+
+    for (unsigned i = 0; i <= target_string.size(); ++i) {
+      if (!ok && i < target_string.size()) {
+        Thread thread;
+        thread.begin = thread.end = i;
+        Program::AddThread(*current, greedy_, 0, i, thread);
+      }
+      if (current->size == 0 && ok) break;
+
+      for (unsigned t = 0; t < current->size; ++t) {
+        Thread& thread = current->threads[t];
+        if (Program::Step(current->pcs[t], target_string, i, greedy_, thread,
+                          *next)) {
+          if constexpr (!kCaptures) return true;
+          Record(target_string, thread, ok);
+          ok = true;
+          break;
+        }
+      }
+      std::swap(current, next);
+      next->Clear();
+    }
+    return ok;
+  }
+
+  bool greedy_ = true;
+  std::vector<std::string> captures_;
+  unsigned begin_ = 0;
+  unsigned end_ = 0;
+  ThreadList lists_[2];
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_DIRECT_VM_H
@@ -0,0 +1,73 @@
+#include "flat_ast.h"
+
+#include <unordered_map>
+
+namespace RGVM {
+namespace internal {
+
+namespace {
+
+int FlattenImpl(const RegexPtr& rp, std::vector<FlatNode>& nodes,
+                std::unordered_map<const RegexNode*, int>& indices) {
+  if (rp == nullptr) return -1;
+  const auto it = indices.find(rp.get());
+  if (it != indices.end()) return it->second;
+  const int left = FlattenImpl(rp->left, nodes, indices);
+  const int right = FlattenImpl(rp->right, nodes, indices);
+  nodes.push_back({rp->type, rp->c, left, right});
+  const int index = nodes.size() - 1;
+  indices.emplace(rp.get(), index);
+  return index;
+}
+
+RegexPtr UnflattenImpl(const std::vector<FlatNode>& nodes, int node,
+                       std::vector<RegexPtr>& built) {
+  if (node < 0) return nullptr;
+  RegexPtr& rp = built[node];
+  if (rp != nullptr) return rp;
+  const FlatNode& n = nodes[node];
+  switch (n.type) {
+    case Alt:
+      rp = AltRegex(UnflattenImpl(nodes, n.left, built),
+                    UnflattenImpl(nodes, n.right, built));
+      break;
+    case Concat:
+      rp = ConcatRegex(UnflattenImpl(nodes, n.left, built),
+                       UnflattenImpl(nodes, n.right, built));
+      break;
+    case Lit:
+      rp = LitRegex(n.c);
+      break;
+    case Dot:
+      rp = DotRegex();
+      break;
+    case Paren:
+      rp = ParenRegex(UnflattenImpl(nodes, n.left, built));
+      break;
+    case Star:
+      rp = StarRegex(UnflattenImpl(nodes, n.left, built));
+      break;
+    case Plus:
+      rp = PlusRegex(UnflattenImpl(nodes, n.left, built));
+      break;
+    case Quest:
+      rp = QuestRegex(UnflattenImpl(nodes, n.left, built));
+      break;
+  }
+  return rp;
+}
+
+}  // namespace
+
+int Flatten(const RegexPtr& rp, std::vector<FlatNode>& nodes) {
+  std::unordered_map<const RegexNode*, int> indices;
+  return FlattenImpl(rp, nodes, indices);
+}
+
+RegexPtr Unflatten(const std::vector<FlatNode>& nodes, int root) {
+  std::vector<RegexPtr> built(nodes.size());
+  return UnflattenImpl(nodes, root, built);
+}
+
+}  // namespace internal
+}  // namespace RGVM
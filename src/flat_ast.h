@@ -0,0 +1,373 @@
+#ifndef RGVM_FLAT_AST_H
+#define RGVM_FLAT_AST_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "instructions.h"
+#include "parser.h"
+
+namespace RGVM {
+namespace internal {
+
+// The simplifier and the compiler, written once over an AST held in an array
+// so that they also run in constant expressions: Simplify() and Compile()
+// flatten the RegexPtr and run them at runtime, StaticRegex runs them on the
+// AST it parses at compile time.
+
+// AST node; children are indices into the node array, -1 if none.
+struct FlatNode {
+  RegexType type = Lit;
+  char c = 0;
+  int left = -1;
+  int right = -1;
+};
+
+// Appends the tree rooted at |rp| to |nodes| and returns the index of its
+// root, -1 if |rp| is null. A node shared by several parents is appended once.
+int Flatten(const RegexPtr& rp, std::vector<FlatNode>& nodes);
+
+// Inverse of Flatten().
+RegexPtr Unflatten(const std::vector<FlatNode>& nodes, int root);
+
+// See Simplify(). The nodes it creates are appended to the given ones, which
+// are left untouched: a subtree with nothing to simplify keeps its index.
+class Simplifier {
+ public:
+  constexpr explicit Simplifier(std::vector<FlatNode> nodes)
+      : nodes_(std::move(nodes)) {}
+
+  constexpr const std::vector<FlatNode>& nodes() const { return nodes_; }
+
+  // Returns the index of the simplified tree rooted at |node|.
+  constexpr int Simplify(int node) {
+    const FlatNode n = nodes_[node];
+    switch (n.type) {
+      case Lit:
+      case Dot:
+        return node;
+      case Paren:
+        return Add(Paren, Simplify(n.left), -1);
+      case Star:
+      case Plus:
+      case Quest: {
+        const int child = Simplify(n.left);
+        if (!IsQuantifier(child)) {
+          if (child == n.left) return node;
+          return Add(n.type, child, -1);
+        }
+        // Parse() never nests quantifiers without a paren in between, but
+        // ASTs built by hand may. x** => x*, x++ => x+, x?? => x?; any other
+        // mix can repeat x any number of times, including none.
+        if (nodes_[child].type == n.type) return child;
+        return Add(Star, nodes_[child].left, -1);
+      }
+      case Concat: {
+        Items items;
+        FlattenConcat(node, items);
+        Items simplified;
+        for (const int item : items) FlattenConcat(Simplify(item), simplified);
+        return BuildConcat(simplified);
+      }
+      case Alt: {
+        Items alternatives;
+        FlattenAlt(node, alternatives);
+        std::vector<Items> branches(alternatives.size());
+        for (size_t i = 0; i < alternatives.size(); ++i)
+          FlattenConcat(Simplify(alternatives[i]), branches[i]);
+        return SimplifyAlt(branches);
+      }
+    }
+    return node;
+  }
+
+ private:
+  using Items = std::vector<int>;
+
+  constexpr int Add(RegexType type, int left, int right) {
+    nodes_.push_back({type, 0, left, right});
+    return nodes_.size() - 1;
+  }
+
+  // Same as operator==(const RegexPtr&, const RegexPtr&).
+  constexpr bool Equal(int a, int b) const {
+    if (a < 0 || b < 0) return a == b;
+    const FlatNode& x = nodes_[a];
+    const FlatNode& y = nodes_[b];
+    if (x.type != y.type) return false;
+    if (x.type == Lit) return x.c == y.c;
+    return Equal(x.left, y.left) && Equal(x.right, y.right);
+  }
+
+  constexpr bool IsQuantifier(int node) const {
+    const RegexType type = nodes_[node].type;
+    return type == Star || type == Plus || type == Quest;
+  }
+
+  // Items that match exactly one character can be moved in or out of an
+  // alternation without changing the order in which threads are explored.
+  constexpr bool IsSingleChar(int node) const {
+    return nodes_[node].type == Lit || nodes_[node].type == Dot;
+  }
+
+  constexpr bool HasParen(int node) const {
+    if (node < 0) return false;
+    if (nodes_[node].type == Paren) return true;
+    return HasParen(nodes_[node].left) || HasParen(nodes_[node].right);
+  }
+
+  constexpr void FlattenConcat(int node, Items& items) const {
+    if (nodes_[node].type != Concat) {
+      items.push_back(node);
+      return;
+    }
+    FlattenConcat(nodes_[node].left, items);
+    FlattenConcat(nodes_[node].right, items);
+  }
+
+  constexpr void FlattenAlt(int node, Items& branches) const {
+    if (nodes_[node].type != Alt) {
+      branches.push_back(node);
+      return;
+    }
+    FlattenAlt(nodes_[node].left, branches);
+    FlattenAlt(nodes_[node].right, branches);
+  }
+
+  // Rebuilds |items|, which must not be empty, into a right-nested Concat
+  // chain.
+  constexpr int BuildConcat(const Items& items) {
+    int node = items.back();
+    for (size_t i = items.size() - 1; i > 0; --i)
+      node = Add(Concat, items[i - 1], node);
+    return node;
+  }
+
+  constexpr int BuildAlt(const Items& branches) {
+    int node = branches.back();
+    for (size_t i = branches.size() - 1; i > 0; --i)
+      node = Add(Alt, branches[i - 1], node);
+    return node;
+  }
+
+  // Factors the single characters shared by the consecutive |branches| out of
+  // the alternation, either at the front (|prefix|) or at the back. The group
+  // of alternatives sharing an item becomes one branch: the shared items
+  // followed or preceded by the alternation of what is left.
+  constexpr std::vector<Items> Factor(const std::vector<Items>& branches,
+                                      bool prefix) {
+    const auto at = [prefix](const Items& items, size_t k) {
+      return prefix ? items[k] : items[items.size() - 1 - k];
+    };
+
+    std::vector<Items> factored;
+    size_t i = 0;
+    while (i < branches.size()) {
+      size_t j = i + 1;
+      if (IsSingleChar(at(branches[i], 0))) {
+        while (j < branches.size() &&
+               Equal(at(branches[j], 0), at(branches[i], 0))) {
+          ++j;
+        }
+      }
+      // Every branch has to keep at least one item: there is no empty regex.
+      size_t shared = 0;
+      if (j - i > 1) {
+        size_t limit = branches[i].size() - 1;
+        for (size_t k = i + 1; k < j; ++k)
+          limit = std::min(limit, branches[k].size() - 1);
+        for (; shared < limit; ++shared) {
+          const int item = at(branches[i], shared);
+          if (!IsSingleChar(item)) break;
+          bool same = true;
+          for (size_t k = i + 1; k < j && same; ++k)
+            same = Equal(at(branches[k], shared), item);
+          if (!same) break;
+        }
+      }
+      if (shared == 0) {
+        factored.push_back(branches[i++]);
+        continue;
+      }
+
+      std::vector<Items> rests;
+      for (size_t k = i; k < j; ++k) {
+        const Items& items = branches[k];
+        rests.emplace_back(prefix ? items.begin() + shared : items.begin(),
+                           prefix ? items.end() : items.end() - shared);
+      }
+      const Items& first = branches[i];
+      Items group(prefix ? first.begin() : first.end() - shared,
+                  prefix ? first.begin() + shared : first.end());
+      const int rest = SimplifyAlt(rests);
+      group.insert(prefix ? group.end() : group.begin(), rest);
+      factored.push_back(std::move(group));
+      i = j;
+    }
+    return factored;
+  }
+
+  // |branches| are the already simplified alternatives, flattened into items.
+  constexpr int SimplifyAlt(const std::vector<Items>& branches) {
+    // Two adjacent copies of a capture-free alternative are next to each
+    // other in the priority order, greedy or not, and match the very same
+    // strings: one of them is enough. Copies further apart must stay, since
+    // whatever lies in between has a higher priority than the later copy when
+    // greedy and a lower one when not. Copies with parens have to stay too,
+    // they own distinct capture groups.
+    std::vector<Items> unique;
+    for (const Items& items : branches) {
+      bool duplicate =
+          !unique.empty() && unique.back().size() == items.size();
+      for (size_t k = 0; duplicate && k < items.size(); ++k)
+        duplicate = !HasParen(items[k]) && Equal(unique.back()[k], items[k]);
+      if (!duplicate) unique.push_back(items);
+    }
+
+    if (unique.size() > 1) unique = Factor(unique, true);
+    if (unique.size() > 1) unique = Factor(unique, false);
+
+    Items alternatives;
+    for (const Items& items : unique)
+      alternatives.push_back(BuildConcat(items));
+    return BuildAlt(alternatives);
+  }
+
+  std::vector<FlatNode> nodes_;
+};
+
+// See Count(). |nodes| is any array of FlatNode.
+template <typename Nodes>
+constexpr unsigned CountNodes(const Nodes& nodes, int node) {
+  if (node < 0) return 0;
+  const FlatNode& n = nodes[node];
+  switch (n.type) {
+    case Alt:
+      return 2 + CountNodes(nodes, n.left) + CountNodes(nodes, n.right);
+    case Concat:
+      return CountNodes(nodes, n.left) + CountNodes(nodes, n.right);
+    case Lit:  // Fall through on purpose.
+    case Dot:
+      return 1;
+    case Plus:  // Fall through on purpose.
+    case Quest:
+      return 1 + CountNodes(nodes, n.left);
+    case Paren:  // Fall through on purpose.
+    case Star:
+      return 2 + CountNodes(nodes, n.left);
+  }
+  return 0;
+}
+
+// See CountParens().
+template <typename Nodes>
+constexpr unsigned CountParenNodes(const Nodes& nodes, int node) {
+  if (node < 0) return 0;
+  const FlatNode& n = nodes[node];
+  return (n.type == Paren ? 1 : 0) + CountParenNodes(nodes, n.left) +
+         CountParenNodes(nodes, n.right);
+}
+
+constexpr Instruction CreateInstr(Opcode op, char c, unsigned x, unsigned y,
+                                  unsigned j, unsigned s) {
+  Instruction instr{};
+  instr.opcode = op;
+  instr.c = c;
+  instr.x = x;
+  instr.y = y;
+  instr.jmp = j;
+  instr.saved = s;
+  return instr;
+}
+
+// Tracks the global state of the compiler: current instruction idx and saved
+// paren index. A reverse compilation emits the program matching the reversed
+// strings, without the capturing instructions.
+struct CompileState {
+  unsigned pc = 0;
+  unsigned saved = 0;
+  bool reverse = false;
+};
+
+// Compiles the tree rooted at |node| into |instructions|, any array of
+// Instruction large enough, from |st.pc| on.
+template <typename Nodes, typename Instructions>
+constexpr void CompileNodes(const Nodes& nodes, int node, CompileState& st,
+                            Instructions& instructions) {
+  if (node < 0) return;
+
+  unsigned& pc = st.pc;
+  unsigned& saved = st.saved;
+  const FlatNode& n = nodes[node];
+
+  switch (n.type) {
+    case Alt: {
+      unsigned idx = pc++;
+      CompileNodes(nodes, n.left, st, instructions);
+      instructions[idx] = CreateInstr(Split, 0, idx + 1, pc + 1, 0, 0);
+
+      idx = pc++;
+      CompileNodes(nodes, n.right, st, instructions);
+      instructions[idx] = CreateInstr(Jmp, 0, 0, 0, pc, 0);
+
+      break;
+    }
+    case Concat:
+      if (st.reverse) {
+        CompileNodes(nodes, n.right, st, instructions);
+        CompileNodes(nodes, n.left, st, instructions);
+      } else {
+        CompileNodes(nodes, n.left, st, instructions);
+        CompileNodes(nodes, n.right, st, instructions);
+      }
+      break;
+    case Lit:
+      instructions[pc++] = CreateInstr(Char, n.c, 0, 0, 0, 0);
+      break;
+    case Dot:
+      instructions[pc++] = CreateInstr(Any, 0, 0, 0, 0, 0);
+      break;
+    case Paren: {
+      if (st.reverse) {
+        CompileNodes(nodes, n.left, st, instructions);
+        break;
+      }
+      const unsigned old_saved = saved;
+      saved += 2;  // must increment saved in st before the recursion.
+      instructions[pc++] = CreateInstr(Save, 0, 0, 0, 0, old_saved);
+      CompileNodes(nodes, n.left, st, instructions);
+      instructions[pc++] = CreateInstr(Save, 0, 0, 0, 0, old_saved + 1);
+
+      break;
+    }
+    case Star: {
+      const unsigned idx = pc++;
+      CompileNodes(nodes, n.left, st, instructions);
+      instructions[pc++] = CreateInstr(Jmp, 0, 0, 0, idx, 0);
+      instructions[idx] = CreateInstr(Split, 0, idx + 1, pc, 0, 0);
+
+      break;
+    }
+    case Plus: {
+      const unsigned idx = pc;
+      CompileNodes(nodes, n.left, st, instructions);
+      ++pc;
+      instructions[pc - 1] = CreateInstr(Split, 0, idx, pc, 0, 0);
+
+      break;
+    }
+    case Quest: {
+      const unsigned idx = pc++;
+      CompileNodes(nodes, n.left, st, instructions);
+      instructions[idx] = CreateInstr(Split, 0, idx + 1, pc, 0, 0);
+
+      break;
+    }
+  }
+}
+
+}  // namespace internal
+}  // namespace RGVM
+
+#endif  // RGVM_FLAT_AST_H
@@ -0,0 +1,131 @@
+#include "gzip_scan.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <memory>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+namespace RGVM {
+
+namespace {
+
+struct Block {
+  std::unique_ptr<char[]> data;
+  // 0 marks the end of the file.
+  size_t size = 0;
+};
+
+// Fixed ring of blocks between one producer and one consumer, both taking
+// the blocks in ring order: the producer waits for a free block and the
+// consumer for a filled one. The blocks are allocated once.
+class BlockRing {
+ public:
+  BlockRing(unsigned num_blocks, size_t block_size)
+      : blocks_(num_blocks), free_(num_blocks), filled_(0) {
+    for (auto& block : blocks_) block.data.reset(new char[block_size]);
+  }
+
+  Block& BeginWrite() {
+    free_.acquire();
+    return blocks_[tail_];
+  }
+
+  void EndWrite() {
+    tail_ = (tail_ + 1) % blocks_.size();
+    filled_.release();
+  }
+
+  Block& BeginRead() {
+    filled_.acquire();
+    return blocks_[head_];
+  }
+
+  void EndRead() {
+    head_ = (head_ + 1) % blocks_.size();
+    free_.release();
+  }
+
+ private:
+  std::vector<Block> blocks_;
+  // Only touched by the consumer and the producer respectively.
+  size_t head_ = 0;
+  size_t tail_ = 0;
+  // Number of free and filled blocks.
+  std::counting_semaphore<> free_, filled_;
+};
+
+}  // namespace
+
+bool ScanGzipFile(const std::string& path, StreamMatcher& matcher,
+                  const MatchCallback& on_match,
+                  const GzipScanOptions& options) {
+  gzFile file = gzopen(path.c_str(), "rb");
+  if (!file) return false;
+  // gzread() returns the bytes read as an int.
+  const size_t block_size = std::clamp<size_t>(options.block_size, 1, INT_MAX);
+  BlockRing ring(std::max(options.num_blocks, 1u), block_size);
+
+  // Written by the producer before the last block, read by the consumer after
+  // it.
+  bool ok = true;
+  // Set by the consumer to have the producer end the file early.
+  std::atomic<bool> stop{false};
+  std::thread producer([&] {
+    for (;;) {
+      Block& block = ring.BeginWrite();
+      const int read = stop ? 0 : gzread(file, block.data.get(), block_size);
+      if (read < 0) ok = false;
+      block.size = std::max(read, 0);
+      ring.EndWrite();
+      if (block.size == 0) break;
+    }
+  });
+
+  matcher.Reset();
+  std::vector<StreamMatch> matches;
+  // Whether the consumer took the last block, and holds a block.
+  bool drained = false, reading = false;
+  try {
+    while (!drained) {
+      Block& block = ring.BeginRead();
+      reading = true;
+      const size_t size = block.size;
+      drained = size == 0;
+      if (size > 0) {
+        matcher.Feed(std::string_view(block.data.get(), size), &matches);
+      } else {
+        matcher.Finish(&matches);
+      }
+      ring.EndRead();
+      reading = false;
+      for (const StreamMatch& match : matches) on_match(match);
+      matches.clear();
+    }
+  } catch (...) {
+    // The producer may be waiting for a free block: let it end the file,
+    // and take the blocks until the last one so that it can be joined.
+    stop = true;
+    if (reading) ring.EndRead();
+    while (!drained) {
+      drained = ring.BeginRead().size == 0;
+      ring.EndRead();
+    }
+    producer.join();
+    gzclose(file);
+    throw;
+  }
+  producer.join();
+  // A truncated file reads as a short one, with Z_BUF_ERROR recorded.
+  int error = Z_OK;
+  gzerror(file, &error);
+  if (error != Z_OK) ok = false;
+  gzclose(file);
+  return ok;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,39 @@
+#ifndef RGVM_GZIP_SCAN_H
+#define RGVM_GZIP_SCAN_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+#include "stream.h"
+
+namespace RGVM {
+
+// Invoked with every match, in uncompressed offsets.
+using MatchCallback = std::function<void(const StreamMatch&)>;
+
+struct GzipScanOptions {
+  // Uncompressed bytes per block, and blocks in flight between the threads.
+  // The ring takes block_size * num_blocks bytes. On top of that the matcher
+  // keeps the bytes of a pending match, which grow with the match: for a.*b,
+  // everything from the first a may be kept, up to the whole file.
+  size_t block_size = 1 << 16;
+  unsigned num_blocks = 4;
+};
+
+// Scans the gzip file at |path| for the matches of |matcher|, the same ones
+// as StreamMatcher over the whole uncompressed text. A background thread
+// decompresses the file into a bounded ring of reusable blocks while the
+// calling thread matches the blocks already decompressed, and invokes
+// |on_match| with every match as soon as it is final. Concatenated gzip
+// members and uncompressed files are read as well. Returns false if the file
+// cannot be opened or is corrupted; the matches reported until then stand.
+// If |on_match| throws, the background thread is stopped and joined before
+// the exception propagates.
+bool ScanGzipFile(const std::string& path, StreamMatcher& matcher,
+                  const MatchCallback& on_match,
+                  const GzipScanOptions& options = {});
+
+}  // namespace RGVM
+
+#endif  // RGVM_GZIP_SCAN_H
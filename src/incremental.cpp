@@ -0,0 +1,209 @@
+#include "incremental.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace RGVM {
+
+bool IncrementalSearch::Edit::Map(unsigned pos, unsigned* mapped) const {
+  if (pos < offset) {
+    *mapped = pos;
+    return true;
+  }
+  if (pos < offset + removed) return false;
+  *mapped = pos - removed + inserted;
+  return true;
+}
+
+bool IncrementalSearch::Compile(const std::string& regexp) {
+  RegexPtr rp;
+  valid_ = false;
+  compiled_ = RGVM::Parse(regexp, rp) && vm_.Compile(regexp);
+  if (!compiled_) return false;
+  instructions_ = RGVM::Compile(Simplify(rp));
+  return true;
+}
+
+void IncrementalSearch::SetGreedy(bool greedy) {
+  greedy_ = greedy;
+  vm_.SetGreedy(greedy);
+  valid_ = false;
+}
+
+void IncrementalSearch::SetCheckpointInterval(unsigned interval) {
+  interval_ = std::max(interval, 1u);
+  valid_ = false;
+}
+
+bool IncrementalSearch::Search(std::string_view text) {
+  if (!compiled_) return false;
+  checkpoints_.clear();
+  return Scan(text, 0, {}, nullptr, {}, 0, {});
+}
+
+bool IncrementalSearch::Update(std::string_view text, unsigned offset,
+                               unsigned removed, unsigned inserted) {
+  if (!compiled_) return false;
+  if (!valid_ || offset + removed > text_size_ ||
+      text.size() != text_size_ - removed + inserted)
+    return Search(text);
+
+  // The previous result only depends on the bytes before the edit.
+  if (result_.scan_end <= offset) {
+    text_size_ = text.size();
+    scanned_bytes_ = 0;
+    return result_.matched;
+  }
+
+  // Resumes from the last checkpoint before the edit; the first checkpoint is
+  // always at 0.
+  const Edit edit{offset, removed, inserted};
+  std::vector<Checkpoint> old = std::move(checkpoints_);
+  auto resume = std::upper_bound(
+      old.begin(), old.end(), offset,
+      [](unsigned pos, const Checkpoint& c) { return pos < c.offset; });
+  --resume;
+  checkpoints_.assign(std::make_move_iterator(old.begin()),
+                      std::make_move_iterator(resume + 1));
+  size_t next_old = resume + 1 - old.begin();
+  while (next_old < old.size() && old[next_old].offset < offset + removed)
+    ++next_old;
+  const Checkpoint& start = checkpoints_.back();
+  return Scan(text, start.offset, start.threads, &edit, std::move(old),
+              next_old, result_);
+}
+
+void IncrementalSearch::AddThreads(SparseSet* set,
+                                   std::vector<unsigned>& begins, unsigned pc,
+                                   unsigned begin) {
+  const unsigned size = set->Size();
+  AddClosure(instructions_, pc, greedy_, *set, stack_);
+  for (auto it = set->begin() + size; it != set->end(); ++it)
+    begins[*it] = begin;
+}
+
+bool IncrementalSearch::SameState(const SparseSet& set,
+                                  const std::vector<unsigned>& begins,
+                                  const Checkpoint& checkpoint,
+                                  const Edit& edit) const {
+  if (set.Size() != checkpoint.threads.size()) return false;
+  auto it = set.begin();
+  for (const ScanThread& thread : checkpoint.threads) {
+    unsigned begin;
+    if (!edit.Map(thread.begin, &begin) ||
+        !(ScanThread{*it, begins[*it]} == ScanThread{thread.pc, begin}))
+      return false;
+    ++it;
+  }
+  return true;
+}
+
+bool IncrementalSearch::Scan(std::string_view text, unsigned from,
+                             const std::vector<ScanThread>& threads,
+                             const Edit* edit, std::vector<Checkpoint> old,
+                             size_t next_old, const ScanResult& previous) {
+  const unsigned program_size = instructions_.size();
+  SparseSet* current = &current_;
+  SparseSet* next = &next_;
+  current->Reset(program_size);
+  next->Reset(program_size);
+  current_begins_.resize(program_size);
+  next_begins_.resize(program_size);
+  std::vector<unsigned>* current_begins = &current_begins_;
+  std::vector<unsigned>* next_begins = &next_begins_;
+  for (const ScanThread& thread : threads) {
+    current->Insert(thread.pc);
+    (*current_begins)[thread.pc] = thread.begin;
+  }
+
+  // Same loop as FindMatchEnd(), see there.
+  ScanResult result;
+  result.scan_end = text.size() + 1;
+  bool converged = false;
+  unsigned i = from;
+  for (; i <= text.size(); ++i) {
+    if (!result.matched) {
+      if ((i - from) % interval_ == 0 &&
+          (checkpoints_.empty() || checkpoints_.back().offset < i)) {
+        Checkpoint checkpoint{i, {}};
+        for (unsigned pc : *current)
+          checkpoint.threads.push_back({pc, (*current_begins)[pc]});
+        checkpoints_.push_back(std::move(checkpoint));
+      }
+      // Past the edit, the previous scan saw the same bytes from its
+      // checkpoints on.
+      unsigned mapped = 0;
+      while (edit && next_old < old.size() &&
+             edit->Map(old[next_old].offset, &mapped) && mapped < i)
+        ++next_old;
+      if (edit && next_old < old.size() && mapped == i &&
+          SameState(*current, *current_begins, old[next_old], *edit)) {
+        converged = true;
+        break;
+      }
+    }
+
+    if (!result.matched && i < text.size())
+      AddThreads(current, *current_begins, 0, i);
+    if (current->Empty()) {
+      if (result.matched) {
+        result.scan_end = i;
+        break;
+      }
+      continue;
+    }
+
+    next->Clear();
+    for (unsigned pc : *current) {
+      const auto& instruction = instructions_[pc];
+      if (instruction.opcode == Match) {
+        result.matched = true;
+        result.begin = (*current_begins)[pc];
+        result.end = i;
+        break;
+      }
+      if (i == text.size()) continue;
+      if (instruction.opcode == Any ||
+          (instruction.opcode == Char && text[i] == instruction.c)) {
+        AddThreads(next, *next_begins, pc + 1, (*current_begins)[pc]);
+      }
+    }
+    std::swap(current, next);
+    std::swap(current_begins, next_begins);
+  }
+  scanned_bytes_ = std::min<unsigned>(i, text.size()) - from;
+
+  if (converged) {
+    // The rest of the previous scan carries over, shifted by the edit.
+    result = previous;
+    if (result.matched) {
+      edit->Map(result.begin, &result.begin);
+      edit->Map(result.end, &result.end);
+    }
+    edit->Map(result.scan_end, &result.scan_end);
+    for (; next_old < old.size(); ++next_old) {
+      Checkpoint& checkpoint = old[next_old];
+      edit->Map(checkpoint.offset, &checkpoint.offset);
+      if (checkpoint.offset <= checkpoints_.back().offset) continue;
+      for (ScanThread& thread : checkpoint.threads)
+        edit->Map(thread.begin, &thread.begin);
+      checkpoints_.push_back(std::move(checkpoint));
+    }
+  }
+  result_ = result;
+  text_size_ = text.size();
+  valid_ = true;
+
+  // The VM needs the byte after an empty match to start a thread, and the
+  // byte after a non-empty one does not change the winning thread.
+  captures_.clear();
+  if (result_.matched) {
+    begin_ = result_.begin;
+    end_ = result_.end;
+    vm_.Search(text.substr(begin_, end_ - begin_ + 1));
+    captures_ = vm_.Captures();
+  }
+  return result_.matched;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,135 @@
+#ifndef RGVM_INCREMENTAL_H
+#define RGVM_INCREMENTAL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "RGVM.h"
+
+namespace RGVM {
+
+// Keeps the result of VM::Search up to date while the searched text is being
+// edited. The match is located with the capture-free forward scan of
+// FindMatchEnd(), extended with the start of every thread, and the scan state
+// is checkpointed every few bytes. After an edit, the scan resumes from the
+// last checkpoint before it, and stops as soon as its state is the same as
+// the previous scan's past the edit: from there on, both scans see the same
+// bytes and reach the same result. Only the captures of the match are then
+// computed, by a VM searching the match alone.
+class IncrementalSearch {
+ public:
+  static constexpr unsigned kDefaultInterval = 4096;
+
+  // Same as VM::Compile().
+  bool Compile(const std::string& regexp);
+
+  // Same as VM::SetGreedy(). The next Update() searches the whole text.
+  void SetGreedy(bool greedy);
+
+  // Bytes between two checkpoints: more checkpoints take more memory but
+  // leave less to rescan before the edits. The next Update() searches the
+  // whole text.
+  void SetCheckpointInterval(unsigned interval);
+
+  // Searches the whole |text|, as VM::Search does.
+  bool Search(std::string_view text);
+
+  // Searches |text|, which is the previously searched text with the |removed|
+  // bytes at |offset| replaced by |inserted| bytes. Searches the whole text if
+  // the edit does not apply to the previous one.
+  bool Update(std::string_view text, unsigned offset, unsigned removed,
+              unsigned inserted);
+
+  // Empty if the last search failed.
+  const std::vector<std::string>& Captures() const { return captures_; }
+
+  // Boundaries of the last match. Only meaningful if the last search
+  // succeeded.
+  Span MatchSpan() const { return {begin_, end_}; }
+
+  // Bytes scanned by the last Search() or Update().
+  uint64_t ScannedBytes() const { return scanned_bytes_; }
+
+ private:
+  // Thread of the forward scan, identified by its PC.
+  struct ScanThread {
+    unsigned pc;
+    unsigned begin;
+
+    bool operator==(const ScanThread& other) const {
+      return pc == other.pc && begin == other.begin;
+    }
+  };
+
+  // Threads alive in priority order before the byte at |offset| is scanned,
+  // none of them having matched yet.
+  struct Checkpoint {
+    unsigned offset;
+    std::vector<ScanThread> threads;
+  };
+
+  // Replacement of |removed| bytes at |offset| by |inserted| bytes.
+  struct Edit {
+    unsigned offset = 0;
+    unsigned removed = 0;
+    unsigned inserted = 0;
+
+    // Maps a position of the text after the edited bytes to the edited text.
+    // Returns false if |pos| is within the removed bytes.
+    bool Map(unsigned pos, unsigned* mapped) const;
+  };
+
+  // Result of a scan, and the bytes it depends on: [0, scan_end), where
+  // scan_end is past the end of the text if the scan reached it.
+  struct ScanResult {
+    bool matched = false;
+    unsigned begin = 0, end = 0;
+    unsigned scan_end = 0;
+  };
+
+  // Scans |text| from |from| with |threads| alive. If |edit| is set, |old|
+  // holds the checkpoints of the previous scan from |next_old| on, |previous|
+  // its result, and the scan stops once it reaches the state of one of them.
+  bool Scan(std::string_view text, unsigned from,
+            const std::vector<ScanThread>& threads, const Edit* edit,
+            std::vector<Checkpoint> old, size_t next_old,
+            const ScanResult& previous);
+
+  // Adds the closure of |pc| to |*set|, the threads it adds starting at
+  // |begin|.
+  void AddThreads(SparseSet* set, std::vector<unsigned>& begins, unsigned pc,
+                  unsigned begin);
+
+  // Whether the threads in |set| are the ones of |checkpoint| before |edit|.
+  bool SameState(const SparseSet& set, const std::vector<unsigned>& begins,
+                 const Checkpoint& checkpoint, const Edit& edit) const;
+
+  bool compiled_ = false;
+  bool greedy_ = true;
+  unsigned interval_ = kDefaultInterval;
+  std::vector<Instruction> instructions_;
+  // Computes the captures of the matches.
+  VM vm_;
+
+  // State of the last scan. Update() starts over if !valid_.
+  bool valid_ = false;
+  unsigned text_size_ = 0;
+  std::vector<Checkpoint> checkpoints_;
+  ScanResult result_;
+
+  std::vector<std::string> captures_;
+  unsigned begin_ = 0;
+  unsigned end_ = 0;
+  uint64_t scanned_bytes_ = 0;
+
+  SparseSet current_, next_;
+  // Start of the thread at every PC of |current_| and |next_|.
+  std::vector<unsigned> current_begins_, next_begins_;
+  std::vector<unsigned> stack_;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_INCREMENTAL_H
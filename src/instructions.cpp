@@ -0,0 +1,115 @@
+//
+// Created by William Liu on 2021-04-15.
+//
+
+#include "instructions.h"
+
+#include <cassert>
+#include <iostream>
+
+#include "flat_ast.h"
+
+namespace RGVM {
+
+using internal::CreateInstr;
+
+bool operator==(const Instruction& a, const Instruction& b) {
+  return a.opcode == b.opcode && a.x == b.x && a.y == b.y && a.jmp == b.jmp &&
+         a.saved == b.saved;
+}
+
+unsigned Count(const RegexPtr& rp) {
+  std::vector<internal::FlatNode> nodes;
+  const int root = internal::Flatten(rp, nodes);
+  return internal::CountNodes(nodes, root);
+}
+
+unsigned CountParens(const RegexPtr& rp) {
+  std::vector<internal::FlatNode> nodes;
+  const int root = internal::Flatten(rp, nodes);
+  return internal::CountParenNodes(nodes, root);
+}
+
+Instruction SplitInstr(unsigned x, unsigned y) {
+  return CreateInstr(Opcode::Split, 0, x, y, 0, 0);
+}
+
+Instruction JmpInstr(unsigned j) {
+  return CreateInstr(Opcode::Jmp, 0, 0, 0, j, 0);
+}
+
+Instruction CharInstr(char c) {
+  return CreateInstr(Opcode::Char, c, 0, 0, 0, 0);
+}
+
+Instruction AnyInstr() { return CreateInstr(Opcode::Any, 0, 0, 0, 0, 0); }
+
+Instruction SaveInstr(unsigned saved) {
+  return CreateInstr(Opcode::Save, 0, 0, 0, 0, saved);
+}
+
+Instruction MatchInstr() { return CreateInstr(Opcode::Match, 0, 0, 0, 0, 0); }
+
+namespace {
+
+std::vector<Instruction> CompileImpl(const RegexPtr& rp, bool reverse) {
+  std::vector<internal::FlatNode> nodes;
+  const int root = internal::Flatten(rp, nodes);
+  // The reverse program has no SAVE, i.e. two instructions less per paren.
+  unsigned size = internal::CountNodes(nodes, root) + 1;
+  if (reverse) size -= 2 * internal::CountParenNodes(nodes, root);
+  std::vector<Instruction> instructions(size);
+  internal::CompileState st;
+  st.reverse = reverse;
+
+  internal::CompileNodes(nodes, root, st, instructions);
+  instructions.back() = MatchInstr();
+  return instructions;
+}
+
+}  // namespace
+
+std::vector<Instruction> Compile(const RegexPtr& rp) {
+  std::vector<Instruction> instructions = CompileImpl(rp, false);
+#ifdef DEBUG
+  PrintInstructions(instructions);
+  std::cout << std::endl;
+#endif
+  return instructions;
+}
+
+std::vector<Instruction> CompileReverse(const RegexPtr& rp) {
+  return CompileImpl(rp, true);
+}
+
+void PrintInstructions(const std::vector<Instruction>& instructions) {
+  for (unsigned i = 0; i < instructions.size(); ++i) {
+    const auto& instr = instructions[i];
+    std::cout << "I" << i << ": ";
+    switch (instr.opcode) {
+      case Opcode::Any:
+        std::cout << "ANY";
+        break;
+      case Opcode::Char:
+        std::cout << "CHAR '" << instr.c << "'";
+        break;
+      case Opcode::Jmp:
+        std::cout << "JMP I" << instr.jmp;
+        break;
+      case Opcode::Match:
+        std::cout << "MATCH";
+        break;
+      case Opcode::Save:
+        std::cout << "SAVE " << instr.saved;
+        break;
+      case Opcode::Split:
+        std::cout << "SPLIT I" << instr.x << " I" << instr.y;
+        break;
+      default:
+        assert(false);
+    }
+    std::cout << std::endl;
+  }
+}
+
+}  // namespace RGVM
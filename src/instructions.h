@@ -46,9 +46,17 @@ Instruction MatchInstr();
 // Calculates the number of instructions required, given an AST root.
 unsigned Count(const RegexPtr& rp);
 
+// Calculates the number of capturing parens, given an AST root.
+unsigned CountParens(const RegexPtr& rp);
+
 // Compiles the AST rooted at |rp| into a vector of instructions.
 std::vector<Instruction> Compile(const RegexPtr& rp);
 
+// Compiles the AST rooted at |rp| into the program that matches the reversed
+// strings, i.e. it matches "cba" iff Compile(rp) matches "abc". The reverse
+// program has no SAVE instruction: it is only used to locate match starts.
+std::vector<Instruction> CompileReverse(const RegexPtr& rp);
+
 void PrintInstructions(const std::vector<Instruction>& instructions);
 };  // namespace RGVM
 
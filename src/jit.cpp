@@ -0,0 +1,190 @@
+#include "jit.h"
+
+#include <cstring>
+#include <initializer_list>
+
+#include "scan.h"
+
+#if defined(RGVM_JIT) && defined(__x86_64__) && defined(__linux__)
+#define RGVM_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace RGVM {
+
+#ifdef RGVM_JIT_X86_64
+
+namespace {
+
+// Positions reached by the closure of a PC, and whether MATCH is.
+struct Closure {
+  uint64_t positions = 0;
+  bool match = false;
+};
+
+Closure ClosureOf(const std::vector<Instruction>& program, unsigned pc,
+                  const std::vector<unsigned>& position_of,
+                  ScanScratch& scratch) {
+  Closure closure;
+  scratch.current.Clear();
+  AddClosure(program, pc, true, scratch.current, scratch.stack);
+  for (unsigned reached : scratch.current) {
+    const Opcode opcode = program[reached].opcode;
+    if (opcode == Char || opcode == Any)
+      closure.positions |= uint64_t{1} << position_of[reached];
+    else if (opcode == Match)
+      closure.match = true;
+  }
+  return closure;
+}
+
+// Just enough of an x86-64 assembler for the code below. Registers:
+// rdi = text, rsi = bytes left, rdx = byte masks, r8 = live positions,
+// r9 = immediate operand, r10 = positions consuming the current byte.
+class Assembler {
+ public:
+  void Emit(std::initializer_list<uint8_t> bytes) {
+    code_.insert(code_.end(), bytes);
+  }
+
+  void EmitImm64(uint64_t imm) {
+    for (unsigned i = 0; i < 8; ++i) code_.push_back(imm >> (8 * i));
+  }
+
+  // mov r9, imm64
+  void MovR9(uint64_t imm) {
+    Emit({0x49, 0xB9});
+    EmitImm64(imm);
+  }
+
+  // Emits a jump with a 32-bit displacement to be bound later; returns the
+  // offset of the displacement.
+  size_t Jump(std::initializer_list<uint8_t> opcode) {
+    Emit(opcode);
+    code_.insert(code_.end(), 4, 0);
+    return code_.size() - 4;
+  }
+
+  // Points the displacement at |at| to |target|.
+  void Bind(size_t at, size_t target) {
+    const int32_t rel = static_cast<int32_t>(target - (at + 4));
+    std::memcpy(&code_[at], &rel, sizeof(rel));
+  }
+
+  size_t Size() const { return code_.size(); }
+  const std::vector<uint8_t>& Code() const { return code_; }
+
+ private:
+  std::vector<uint8_t> code_;
+};
+
+}  // namespace
+
+bool JitProgram::Supported() { return true; }
+
+std::unique_ptr<JitProgram> JitProgram::Compile(
+    const std::vector<Instruction>& program) {
+  std::vector<unsigned> position_of(program.size(), 0);
+  std::vector<unsigned> pcs;
+  for (unsigned pc = 0; pc < program.size(); ++pc) {
+    const Opcode opcode = program[pc].opcode;
+    if (opcode != Char && opcode != Any) continue;
+    if (pcs.size() == kMaxPositions) return nullptr;
+    position_of[pc] = pcs.size();
+    pcs.push_back(pc);
+  }
+
+  std::unique_ptr<JitProgram> jit(new JitProgram());
+  ScanScratch scratch;
+  scratch.Reset(program.size());
+  const Closure start = ClosureOf(program, 0, position_of, scratch);
+  jit->matches_empty_ = start.match;
+  uint64_t accept = 0;
+  std::vector<uint64_t> follow(pcs.size());
+  for (unsigned k = 0; k < pcs.size(); ++k) {
+    const Instruction& instruction = program[pcs[k]];
+    for (unsigned c = 0; c < 256; ++c) {
+      if (instruction.opcode == Any ||
+          static_cast<unsigned char>(instruction.c) == c)
+        jit->byte_masks_[c] |= uint64_t{1} << k;
+    }
+    const Closure next = ClosureOf(program, pcs[k] + 1, position_of, scratch);
+    follow[k] = next.positions;
+    if (next.match) accept |= uint64_t{1} << k;
+  }
+
+  Assembler as;
+  as.Emit({0x45, 0x31, 0xC0});  // xor r8d, r8d
+  const size_t loop = as.Size();
+  as.Emit({0x48, 0x85, 0xF6});  // test rsi, rsi
+  const size_t to_not_found = as.Jump({0x0F, 0x84});  // jz not_found
+  // Unanchored: a thread starts at every byte.
+  if (start.positions) {
+    as.MovR9(start.positions);
+    as.Emit({0x4D, 0x09, 0xC8});  // or r8, r9
+  }
+  as.Emit({0x0F, 0xB6, 0x0F});        // movzx ecx, byte [rdi]
+  as.Emit({0x4C, 0x8B, 0x14, 0xCA});  // mov r10, [rdx + rcx * 8]
+  as.Emit({0x4D, 0x21, 0xC2});        // and r10, r8
+  size_t to_found = 0;
+  if (accept) {
+    as.MovR9(accept);
+    as.Emit({0x4D, 0x85, 0xCA});             // test r10, r9
+    to_found = as.Jump({0x0F, 0x85});        // jnz found
+  }
+  as.Emit({0x45, 0x31, 0xC0});  // xor r8d, r8d
+  for (unsigned k = 0; k < pcs.size(); ++k) {
+    if (follow[k] == 0) continue;
+    as.Emit({0x49, 0x0F, 0xBA, 0xE2, static_cast<uint8_t>(k)});  // bt r10, k
+    as.Emit({0x73, 0x0D});  // jnc over the next 13 bytes
+    as.MovR9(follow[k]);
+    as.Emit({0x4D, 0x09, 0xC8});  // or r8, r9
+  }
+  as.Emit({0x48, 0xFF, 0xC7});  // inc rdi
+  as.Emit({0x48, 0xFF, 0xCE});  // dec rsi
+  as.Bind(as.Jump({0xE9}), loop);  // jmp loop
+  as.Bind(to_not_found, as.Size());
+  as.Emit({0x31, 0xC0, 0xC3});  // xor eax, eax; ret
+  if (accept) as.Bind(to_found, as.Size());
+  as.Emit({0xB8, 0x01, 0x00, 0x00, 0x00, 0xC3});  // mov eax, 1; ret
+
+  // Written, then made executable: never both at the same time.
+  void* code = mmap(nullptr, as.Size(), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) return nullptr;
+  std::memcpy(code, as.Code().data(), as.Size());
+  if (mprotect(code, as.Size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(code, as.Size());
+    return nullptr;
+  }
+  jit->code_ = code;
+  jit->code_size_ = as.Size();
+  jit->function_ = reinterpret_cast<Function>(code);
+  return jit;
+}
+
+JitProgram::~JitProgram() {
+  if (code_) munmap(code_, code_size_);
+}
+
+#else  // RGVM_JIT_X86_64
+
+bool JitProgram::Supported() { return false; }
+
+std::unique_ptr<JitProgram> JitProgram::Compile(
+    const std::vector<Instruction>&) {
+  return nullptr;
+}
+
+JitProgram::~JitProgram() = default;
+
+#endif  // RGVM_JIT_X86_64
+
+bool JitProgram::Matches(std::string_view text) const {
+  // VM::Search never starts a thread at the end of the text.
+  if (text.empty()) return false;
+  if (matches_empty_) return true;
+  return function_(text.data(), text.size(), byte_masks_);
+}
+
+}  // namespace RGVM
@@ -0,0 +1,59 @@
+#ifndef RGVM_JIT_H
+#define RGVM_JIT_H
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "instructions.h"
+
+namespace RGVM {
+
+// Native x86-64 code answering whether a text contains a match of a program,
+// i.e. the same as MatchesAny(). The threads are kept in a bit set: bit k
+// stands for the k-th CHAR or ANY of the program, hence at most kMaxPositions
+// of them. Each byte costs one table lookup plus one test per position, with
+// no branch on the instructions themselves.
+class JitProgram {
+ public:
+  static constexpr unsigned kMaxPositions = 64;
+
+  // Whether the JIT is compiled in (RGVM_JIT) and supports the host.
+  static bool Supported();
+
+  // Returns nullptr if the JIT is not supported, the program has too many
+  // positions or the executable memory cannot be mapped. Callers fall back to
+  // the interpreter then.
+  static std::unique_ptr<JitProgram> Compile(
+      const std::vector<Instruction>& program);
+
+  ~JitProgram();
+
+  JitProgram(const JitProgram&) = delete;
+  JitProgram& operator=(const JitProgram&) = delete;
+
+  bool Matches(std::string_view text) const;
+
+  // Bytes held by the native code and its tables.
+  size_t MemoryUsage() const { return sizeof(*this) + code_size_; }
+
+ private:
+  using Function = bool (*)(const char* text, size_t size,
+                            const uint64_t* byte_masks);
+
+  JitProgram() = default;
+
+  // Executable memory holding |function_|.
+  void* code_ = nullptr;
+  size_t code_size_ = 0;
+  Function function_ = nullptr;
+  // Positions able to consume each byte.
+  uint64_t byte_masks_[256] = {};
+  // Whether the program matches the empty string, i.e. any non-empty text.
+  bool matches_empty_ = false;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_JIT_H
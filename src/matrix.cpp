@@ -0,0 +1,131 @@
+#include "matrix.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace RGVM {
+
+namespace {
+
+// Tile of the matrix: pattern block |t / num_document_blocks| × document
+// block |t % num_document_blocks|.
+using Task = unsigned;
+
+// Tasks of one worker. The owner takes them from the front, in order; the
+// thieves from the back, furthest from what the owner works on.
+class TaskQueue {
+ public:
+  void Push(Task task) { tasks_.push_back(task); }
+
+  bool Pop(Task* task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) return false;
+    *task = tasks_.front();
+    tasks_.pop_front();
+    return true;
+  }
+
+  bool Steal(Task* task) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (tasks_.empty()) return false;
+    *task = tasks_.back();
+    tasks_.pop_back();
+    return true;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::deque<Task> tasks_;
+};
+
+}  // namespace
+
+bool HitMatrix::Hit(unsigned pattern, unsigned document) const {
+  return std::binary_search(patterns.begin() + offsets[document],
+                            patterns.begin() + offsets[document + 1],
+                            pattern);
+}
+
+HitMatrix MatchMatrix(std::span<const VM* const> patterns,
+                      std::span<const std::string_view> documents,
+                      const MatrixOptions& options) {
+  const unsigned patterns_per_block = std::max(options.patterns_per_block, 1u);
+  const unsigned documents_per_block =
+      std::max(options.documents_per_block, 1u);
+  const unsigned num_pattern_blocks =
+      (patterns.size() + patterns_per_block - 1) / patterns_per_block;
+  const unsigned num_document_blocks =
+      (documents.size() + documents_per_block - 1) / documents_per_block;
+  const unsigned num_tasks = num_pattern_blocks * num_document_blocks;
+  unsigned num_threads = options.num_threads;
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::max(1u, std::min(num_threads, num_tasks));
+
+  // Every worker starts with a contiguous share of the tiles.
+  std::vector<TaskQueue> queues(num_threads);
+  for (Task task = 0; task < num_tasks; ++task)
+    queues[uint64_t{task} * num_threads / num_tasks].Push(task);
+
+  // Hits of every worker, as (document, pattern).
+  std::vector<std::vector<std::pair<unsigned, unsigned>>> hits(num_threads);
+  const auto work = [&](unsigned worker) {
+    ScanScratch scratch;
+    auto& found = hits[worker];
+    const auto run = [&](Task task) {
+      const unsigned first_pattern =
+          task / num_document_blocks * patterns_per_block;
+      const unsigned first_document =
+          task % num_document_blocks * documents_per_block;
+      const unsigned last_pattern = std::min<size_t>(
+          first_pattern + patterns_per_block, patterns.size());
+      const unsigned last_document = std::min<size_t>(
+          first_document + documents_per_block, documents.size());
+      // The pattern block is small enough to stay in the cache while the
+      // documents go by.
+      for (unsigned d = first_document; d < last_document; ++d) {
+        for (unsigned p = first_pattern; p < last_pattern; ++p) {
+          if (patterns[p]->Matches(documents[d], scratch))
+            found.emplace_back(d, p);
+        }
+      }
+    };
+    Task task;
+    while (queues[worker].Pop(&task)) run(task);
+    // No task is ever added: once every queue is empty, all is done.
+    for (unsigned i = 1; i < num_threads; ++i) {
+      TaskQueue& victim = queues[(worker + i) % num_threads];
+      while (victim.Steal(&task)) run(task);
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < num_threads; ++i) workers.emplace_back(work, i);
+  work(0);
+  for (auto& worker : workers) worker.join();
+
+  // Rows of the matrix, by counting sort on the documents.
+  HitMatrix matrix;
+  matrix.offsets.assign(documents.size() + 1, 0);
+  for (const auto& found : hits) {
+    for (const auto& [document, pattern] : found)
+      ++matrix.offsets[document + 1];
+  }
+  for (size_t d = 0; d < documents.size(); ++d)
+    matrix.offsets[d + 1] += matrix.offsets[d];
+  matrix.patterns.resize(matrix.offsets.back());
+  std::vector<unsigned> next(matrix.offsets.begin(), matrix.offsets.end() - 1);
+  for (const auto& found : hits) {
+    for (const auto& [document, pattern] : found)
+      matrix.patterns[next[document]++] = pattern;
+  }
+  for (size_t d = 0; d < documents.size(); ++d) {
+    std::sort(matrix.patterns.begin() + matrix.offsets[d],
+              matrix.patterns.begin() + matrix.offsets[d + 1]);
+  }
+  return matrix;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,46 @@
+#ifndef RGVM_MATRIX_H
+#define RGVM_MATRIX_H
+
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "RGVM.h"
+
+namespace RGVM {
+
+struct MatrixOptions {
+  // Worker threads, or one per hardware thread if 0.
+  unsigned num_threads = 0;
+  // Size of the tiles: every task matches a block of patterns against a
+  // block of documents.
+  unsigned patterns_per_block = 16;
+  unsigned documents_per_block = 64;
+};
+
+// Sparse document × pattern matrix, one row per document: the patterns
+// matching document d are patterns[offsets[d], offsets[d + 1]), in increasing
+// order.
+struct HitMatrix {
+  std::vector<unsigned> offsets;
+  std::vector<unsigned> patterns;
+
+  // Whether |pattern| matches |document|.
+  bool Hit(unsigned pattern, unsigned document) const;
+  size_t NumHits() const { return patterns.size(); }
+};
+
+// Finds which of the compiled |patterns| match which of the |documents|, as
+// VM::Matches does. The matrix is tiled into pattern block × document block
+// tasks run by a pool of worker threads. Each worker goes through its share
+// of the tiles in order, so that consecutive tiles keep the same pattern
+// block hot in the cache, and steals tiles from the other end of another
+// worker's share once done with its own. Each worker keeps its own scan
+// scratch memory.
+HitMatrix MatchMatrix(std::span<const VM* const> patterns,
+                      std::span<const std::string_view> documents,
+                      const MatrixOptions& options = {});
+
+}  // namespace RGVM
+
+#endif  // RGVM_MATRIX_H
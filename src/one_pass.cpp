@@ -0,0 +1,195 @@
+#include "one_pass.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+
+#include "scan.h"
+
+namespace RGVM {
+
+namespace {
+
+// What the threads in the closure of a PC do with the next byte.
+struct Reach {
+  std::bitset<256> bytes;
+  bool any = false;
+  bool match = false;
+};
+
+Reach ReachFrom(const std::vector<Instruction>& program, unsigned pc,
+                ScanScratch& scratch) {
+  Reach reach;
+  scratch.current.Clear();
+  AddClosure(program, pc, true, scratch.current, scratch.stack);
+  for (unsigned reached : scratch.current) {
+    const auto& instruction = program[reached];
+    if (instruction.opcode == Char)
+      reach.bytes.set(static_cast<unsigned char>(instruction.c));
+    else if (instruction.opcode == Any)
+      reach.any = true;
+    else if (instruction.opcode == Match)
+      reach.match = true;
+  }
+  return reach;
+}
+
+bool Overlap(const Reach& a, const Reach& b) {
+  if (a.match && b.match) return true;
+  if ((a.bytes & b.bytes).any()) return true;
+  return (a.any && (b.any || b.bytes.any())) || (b.any && a.bytes.any());
+}
+
+// A CHAR, ANY or MATCH reached from a state, and the slots saved on the way.
+struct Terminal {
+  unsigned pc;
+  std::vector<unsigned> saves;
+};
+
+// Same walk as AddThread in RGVM.cpp: |terminals| ends up in thread priority
+// order.
+void Explore(const std::vector<Instruction>& program, unsigned pc, bool greedy,
+             std::vector<bool>& visited, std::vector<unsigned>& saves,
+             std::vector<Terminal>* terminals) {
+  if (visited[pc]) return;
+  visited[pc] = true;
+  const auto& instruction = program[pc];
+  switch (instruction.opcode) {
+    case Jmp:
+      Explore(program, instruction.jmp, greedy, visited, saves, terminals);
+      break;
+    case Split:
+      Explore(program, greedy ? instruction.x : instruction.y, greedy, visited,
+              saves, terminals);
+      Explore(program, greedy ? instruction.y : instruction.x, greedy, visited,
+              saves, terminals);
+      break;
+    case Save:
+      saves.push_back(instruction.saved);
+      Explore(program, pc + 1, greedy, visited, saves, terminals);
+      saves.pop_back();
+      break;
+    case Char:
+    case Any:
+    case Match:
+      terminals->push_back({pc, saves});
+      break;
+    default:
+      assert(false);
+  }
+}
+
+}  // namespace
+
+bool IsOnePass(const std::vector<Instruction>& program) {
+  ScanScratch scratch;
+  scratch.Reset(program.size());
+  for (const auto& instruction : program) {
+    if (instruction.opcode != Split) continue;
+    if (Overlap(ReachFrom(program, instruction.x, scratch),
+                ReachFrom(program, instruction.y, scratch)))
+      return false;
+  }
+  return true;
+}
+
+OnePass::OnePass(const std::vector<Instruction>& program, bool greedy) {
+  assert(IsOnePass(program));
+  for (const auto& instruction : program) {
+    if (instruction.opcode == Char) {
+      auto& cls = byte_class_[static_cast<unsigned char>(instruction.c)];
+      if (cls == 0) cls = num_classes_++;
+    } else if (instruction.opcode == Save) {
+      num_slots_ = std::max(num_slots_, instruction.saved + 1);
+    }
+  }
+
+  // A state is the PC the thread resumes at after consuming a byte, or the
+  // program start.
+  std::vector<unsigned> state_of(program.size(), kNone);
+  std::vector<unsigned> entries;
+  const auto state_for = [&](unsigned pc) {
+    if (state_of[pc] == kNone) {
+      state_of[pc] = num_states_++;
+      entries.push_back(pc);
+    }
+    return state_of[pc];
+  };
+  state_for(0);
+
+  std::vector<bool> visited;
+  std::vector<unsigned> saves;
+  std::vector<Terminal> terminals;
+  for (unsigned state = 0; state < entries.size(); ++state) {
+    visited.assign(program.size(), false);
+    terminals.clear();
+    Explore(program, entries[state], greedy, visited, saves, &terminals);
+    steps_.resize((state + 1) * num_classes_);
+    matches_.resize(state + 1);
+
+    for (const auto& terminal : terminals) {
+      Step step;
+      step.saves_begin = saves_.size();
+      saves_.insert(saves_.end(), terminal.saves.begin(), terminal.saves.end());
+      step.saves_end = saves_.size();
+
+      const auto& instruction = program[terminal.pc];
+      if (instruction.opcode == Match) {
+        // The lower priority threads are cut by the match.
+        step.next = 0;
+        matches_[state] = step;
+        break;
+      }
+      step.next = state_for(terminal.pc + 1);
+      Step* row = &steps_[state * num_classes_];
+      for (unsigned cls = 0; cls < num_classes_; ++cls) {
+        if (instruction.opcode == Char &&
+            cls != byte_class_[static_cast<unsigned char>(instruction.c)])
+          continue;
+        // Higher priority threads come first.
+        if (row[cls].next == kNone) row[cls] = step;
+      }
+    }
+  }
+}
+
+bool OnePass::Search(std::string_view text, unsigned from, unsigned to,
+                     std::vector<unsigned>& scratch,
+                     std::vector<unsigned>* slots, unsigned* end) const {
+  // Like the saved slots of a VM thread, only the slots up to the highest one
+  // written so far are reported; the ones never written are 0.
+  scratch.assign(num_slots_, 0);
+  unsigned used = 0;
+  const auto save = [&](const Step& step, unsigned pos,
+                        std::vector<unsigned>& into) {
+    for (unsigned k = step.saves_begin; k < step.saves_end; ++k) {
+      into[saves_[k]] = pos;
+      used = std::max(used, saves_[k] + 1);
+    }
+  };
+
+  bool matched = false;
+  unsigned state = 0;
+  for (unsigned i = from;; ++i) {
+    const Step& match = matches_[state];
+    if (match.next != kNone) {
+      const unsigned thread_used = used;
+      *slots = scratch;
+      save(match, i, *slots);
+      slots->resize(used);
+      used = thread_used;
+      *end = i;
+      matched = true;
+    }
+    if (i == to) break;
+
+    const Step& step = steps_[state * num_classes_ +
+                              byte_class_[static_cast<unsigned char>(text[i])]];
+    if (step.next == kNone) break;
+    save(step, i, scratch);
+    state = step.next;
+  }
+  return matched;
+}
+
+}  // namespace RGVM
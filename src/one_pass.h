@@ -0,0 +1,77 @@
+#ifndef RGVM_ONE_PASS_H
+#define RGVM_ONE_PASS_H
+
+#include <string_view>
+#include <vector>
+
+#include "instructions.h"
+
+namespace RGVM {
+
+// Returns whether |program| is one-pass: the two branches of every SPLIT can
+// never both consume the next byte, nor both reach MATCH. Then at most one
+// thread is alive per byte, whatever the thread priority.
+bool IsOnePass(const std::vector<Instruction>& program);
+
+// Deterministic executor of a one-pass program. Every state of the single
+// thread is compiled into a table indexed by byte class: each byte is one
+// table lookup, and the capture slots are written in place instead of being
+// copied along with forked threads.
+//
+// The executor is anchored: it needs to know where the match starts. Since the
+// grammar has no anchors, VM::Search first locates the match with the two
+// capture-free scans of TwoPass and only then runs the executor over the
+// match, so it only makes the capture extraction cheaper, not the search.
+class OnePass {
+ public:
+  // |program| must be one-pass.
+  OnePass(const std::vector<Instruction>& program, bool greedy);
+
+  OnePass(const OnePass&) = delete;
+  OnePass& operator=(const OnePass&) = delete;
+
+  // Runs the program over text[from, to], anchored at |from|, and finds the
+  // match VM::Search would report among the ones starting at |from|. Saves
+  // its end into |end| and its SAVE slots into |slots|, sized like the saved
+  // slots of the matching VM thread. |scratch| holds the running thread's
+  // slots. Returns false if there is no match.
+  bool Search(std::string_view text, unsigned from, unsigned to,
+              std::vector<unsigned>& scratch, std::vector<unsigned>* slots,
+              unsigned* end) const;
+
+  unsigned NumStates() const { return num_states_; }
+
+  // Bytes held by the tables.
+  size_t MemoryUsage() const {
+    return sizeof(*this) +
+           (steps_.capacity() + matches_.capacity()) * sizeof(Step) +
+           saves_.capacity() * sizeof(unsigned);
+  }
+
+ private:
+  static constexpr unsigned kNone = ~0u;
+
+  // Move to state |next| (if not kNone) after writing the current position
+  // into the slots saves_[saves_begin, saves_end).
+  struct Step {
+    unsigned next = kNone;
+    unsigned saves_begin = 0;
+    unsigned saves_end = 0;
+  };
+
+  // Bytes that never occur in a CHAR share class 0.
+  unsigned char byte_class_[256] = {};
+  unsigned num_classes_ = 1;
+
+  unsigned num_states_ = 0;
+  // Indexed by state * num_classes_ + byte class.
+  std::vector<Step> steps_;
+  // Indexed by state. |next| is 0 if the state matches, kNone otherwise.
+  std::vector<Step> matches_;
+  std::vector<unsigned> saves_;
+  unsigned num_slots_ = 0;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_ONE_PASS_H
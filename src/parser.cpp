@@ -2,7 +2,10 @@
 
 #include <boost/spirit/include/phoenix.hpp>
 #include <boost/spirit/include/qi.hpp>
+#include <cassert>
 #include <iostream>
+#include <unordered_set>
+#include <vector>
 
 namespace RGVM {
 
@@ -124,6 +127,24 @@ void PrintRegexpImpl(const RegexPtr& rp, int depth) {
 
 void PrintRegexpAST(const RegexPtr& rp) { PrintRegexpImpl(rp, 0); }
 
+size_t AstMemoryUsage(const RegexPtr& rp) {
+  // Every node comes from std::make_shared, next to a control block holding a
+  // vtable pointer and the two reference counts.
+  constexpr size_t kNodeBytes =
+      sizeof(RegexNode) + sizeof(void*) + 2 * sizeof(int);
+  std::unordered_set<const RegexNode*> seen;
+  std::vector<const RegexNode*> stack;
+  if (rp) stack.push_back(rp.get());
+  while (!stack.empty()) {
+    const RegexNode* node = stack.back();
+    stack.pop_back();
+    if (!seen.insert(node).second) continue;
+    if (node->left) stack.push_back(node->left.get());
+    if (node->right) stack.push_back(node->right.get());
+  }
+  return seen.size() * kNodeBytes;
+}
+
 // Regular expression grammar.
 template <typename Iterator>
 struct RegexGrammar : qi::grammar<Iterator, RegexPtr()> {
@@ -155,10 +176,17 @@ struct RegexGrammar : qi::grammar<Iterator, RegexPtr()> {
   }
 };
 
-bool Parse(const std::string& regexp, RegexPtr& rp) {
-  RegexGrammar<std::string::const_iterator> grammar;
-  auto ok =
-      qi::phrase_parse(regexp.begin(), regexp.end(), grammar, ascii::space, rp);
+bool Parse(const std::string& regexp, RegexPtr& rp, size_t* error_offset) {
+  // Building the grammar costs more than parsing most patterns, so every
+  // thread builds it once and reuses it.
+  thread_local const RegexGrammar<std::string::const_iterator> grammar;
+  // phrase_parse() stops at the end of the longest valid prefix: the rest of
+  // the input must be empty.
+  auto first = regexp.begin();
+  const bool ok =
+      qi::phrase_parse(first, regexp.end(), grammar, ascii::space, rp) &&
+      first == regexp.end();
+  if (!ok && error_offset) *error_offset = first - regexp.begin();
 #ifdef DEBUG
   PrintRegexpAST(rp);
   std::cout << std::endl;
@@ -33,8 +33,16 @@ RegexPtr LitRegex(char c);
 RegexPtr DotRegex();
 
 // Parse the regular expression string into AST using Boost. AST's root is saved
-// as |rp|.
-bool Parse(const std::string& regexp, RegexPtr& rp);
+// as |rp|. The whole string must be a regexp, up to leading and trailing
+// spaces; if it is not, the offset where parsing stopped is saved into
+// |*error_offset| if not null. Thread-safe; the grammar is built once per
+// thread.
+bool Parse(const std::string& regexp, RegexPtr& rp,
+           size_t* error_offset = nullptr);
+
+// Bytes held by the AST rooted at |rp|, counting the nodes shared by several
+// parents once.
+size_t AstMemoryUsage(const RegexPtr& rp);
 
 // Print out the parsed regexp.
 void PrintRegexpAST(const RegexPtr& rp);
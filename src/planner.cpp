@@ -0,0 +1,126 @@
+#include "planner.h"
+
+#include <iostream>
+
+#include "one_pass.h"
+#include "scan.h"
+
+namespace RGVM {
+
+namespace {
+
+// Appends the literal every match of |rp| starts with to |prefix|. Returns
+// whether the whole of |rp| is that literal, i.e. whether the caller may carry
+// on with what follows |rp|.
+bool AppendPrefix(const RegexPtr& rp, std::string* prefix) {
+  switch (rp->type) {
+    case Lit:
+      prefix->push_back(rp->c);
+      return true;
+    case Concat:
+      return AppendPrefix(rp->left, prefix) && AppendPrefix(rp->right, prefix);
+    case Paren:
+      return AppendPrefix(rp->left, prefix);
+    case Plus:
+      // x+ starts with x, but what follows may be another x.
+      AppendPrefix(rp->left, prefix);
+      return false;
+    default:
+      return false;
+  }
+}
+
+const char* EngineName(Engine engine) {
+  switch (engine) {
+    case Engine::Auto:
+      return "Auto";
+    case Engine::Pike:
+      return "Pike";
+    case Engine::TwoPass:
+      return "TwoPass";
+    case Engine::OnePass:
+      return "OnePass";
+    case Engine::AhoCorasick:
+      return "AhoCorasick";
+  }
+  return "?";
+}
+
+}  // namespace
+
+SearchPlan MakePlan(const RegexPtr& rp, const std::vector<Instruction>& program,
+                    unsigned num_literals) {
+  SearchPlan plan;
+  plan.program_size = program.size();
+  plan.num_captures = CountParens(rp);
+  plan.num_literals = num_literals;
+  AppendPrefix(rp, &plan.prefix);
+
+  ScanScratch scratch;
+  scratch.Reset(program.size());
+  AddClosure(program, 0, true, scratch.current, scratch.stack);
+  for (unsigned pc : scratch.current) {
+    const auto& instruction = program[pc];
+    if (instruction.opcode == Char) {
+      plan.first_bytes.set(static_cast<unsigned char>(instruction.c));
+    } else if (instruction.opcode == Any || instruction.opcode == Match) {
+      // A MATCH here means the match may be empty.
+      plan.first_bytes.set();
+      break;
+    }
+  }
+
+  plan.ambiguous = !IsOnePass(program);
+  return plan;
+}
+
+Engine ChooseEngine(const SearchPlan& plan, size_t input_size) {
+  if (plan.num_literals) return Engine::AhoCorasick;
+  // Without captures the two scans never copy a thread.
+  if (plan.num_captures == 0) return Engine::TwoPass;
+  // Same scans as TwoPass, with a cheaper capture extraction.
+  if (!plan.ambiguous) return Engine::OnePass;
+  if (input_size >= kTwoPassMinInput) return Engine::TwoPass;
+  return Engine::Pike;
+}
+
+bool SkipToCandidate(const SearchPlan& plan, std::string_view text,
+                     unsigned* from) {
+  if (!plan.prefix.empty()) {
+    const size_t pos = text.find(plan.prefix, *from);
+    if (pos == std::string_view::npos) return false;
+    *from = pos;
+    return true;
+  }
+  if (plan.first_bytes.all()) return *from < text.size();
+  for (unsigned i = *from; i < text.size(); ++i) {
+    if (plan.first_bytes[static_cast<unsigned char>(text[i])]) {
+      *from = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PrintPlan(const SearchPlan& plan) {
+  std::cout << "program size: " << plan.program_size << std::endl;
+  std::cout << "captures: " << plan.num_captures << std::endl;
+  std::cout << "literals: " << plan.num_literals << std::endl;
+  std::cout << "prefix: \"" << plan.prefix << "\"" << std::endl;
+  std::cout << "first bytes: ";
+  if (plan.first_bytes.all()) {
+    std::cout << "any";
+  } else {
+    for (unsigned c = 0; c < 256; ++c)
+      if (plan.first_bytes[c]) std::cout << static_cast<char>(c);
+  }
+  std::cout << std::endl;
+  std::cout << "anchored: " << (plan.anchored ? "yes" : "no") << std::endl;
+  std::cout << "ambiguous: " << (plan.ambiguous ? "yes" : "no") << std::endl;
+  std::cout << "engine: " << EngineName(ChooseEngine(plan, 0)) << " below "
+            << kTwoPassMinInput << " bytes, "
+            << EngineName(ChooseEngine(plan, kTwoPassMinInput)) << " above"
+            << std::endl;
+}
+
+}  // namespace RGVM
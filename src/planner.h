@@ -0,0 +1,60 @@
+#ifndef RGVM_PLANNER_H
+#define RGVM_PLANNER_H
+
+#include <bitset>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "instructions.h"
+#include "parser.h"
+#include "stats.h"
+
+namespace RGVM {
+
+// Inputs at least this long are searched with the two-pass engine even when
+// captures are needed: the capture tracking VM then only runs over the match.
+constexpr unsigned kTwoPassMinInput = 256;
+
+// What VM::Compile learned about a pattern, and which engine serves it.
+struct SearchPlan {
+  // Instructions of the forward program.
+  unsigned program_size = 0;
+  // Capturing parens.
+  unsigned num_captures = 0;
+  // Number of literals if the regexp is an alternation of plain literals.
+  unsigned num_literals = 0;
+  // Literal every match starts with; may be empty.
+  std::string prefix;
+  // Bytes a match can start with. All set if a match may start with any byte,
+  // or be empty.
+  std::bitset<256> first_bytes;
+  // Whether matches are bound to the start of the input. The grammar has no
+  // anchor yet, so this is always false.
+  bool anchored = false;
+  // Whether the program is not one-pass, see IsOnePass(): i.e. more than one
+  // thread may be alive per byte.
+  bool ambiguous = false;
+};
+
+// Analyzes the pattern whose simplified AST is |rp| and which compiles into
+// |program|. |num_literals| is the size of the literal alternation the pattern
+// spells, if any.
+SearchPlan MakePlan(const RegexPtr& rp, const std::vector<Instruction>& program,
+                    unsigned num_literals);
+
+// Picks the cheapest engine able to serve |plan| over an input of
+// |input_size| bytes.
+Engine ChooseEngine(const SearchPlan& plan, size_t input_size);
+
+// Prefilter: finds the first position of |text| at or after |*from| where a
+// match may start, and saves it into |*from|. Returns false if there is none.
+bool SkipToCandidate(const SearchPlan& plan, std::string_view text,
+                     unsigned* from);
+
+// Prints out the plan, and the engine picked for short and long inputs.
+void PrintPlan(const SearchPlan& plan);
+
+}  // namespace RGVM
+
+#endif  // RGVM_PLANNER_H
@@ -0,0 +1,157 @@
+#include "rewrite.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace RGVM {
+
+namespace {
+
+// Searches text[pos, end) with |vm| and saves the match into |*match|, as a
+// span of |text|.
+bool SearchFrom(VM& vm, std::string_view text, unsigned pos, Span* match) {
+  if (pos >= text.size() || !vm.SearchSpans(text.substr(pos))) return false;
+  *match = {pos + vm.MatchSpan().begin, pos + vm.MatchSpan().end};
+  return true;
+}
+
+char* Copy(std::string_view text, unsigned begin, unsigned end, char* out) {
+  return std::copy(text.begin() + begin, text.begin() + end, out);
+}
+
+// The matches found by ReplaceImpl(), and the range of |captures| holding
+// their captures.
+struct Found {
+  Span match;
+  unsigned first_capture, last_capture;
+};
+
+// Replaces up to |max_matches| matches, see ReplaceAll().
+unsigned ReplaceImpl(VM& vm, std::string_view text,
+                     const ReplaceTemplate& replacement, std::string* out,
+                     unsigned max_matches) {
+  // Every thread keeps its scratch, so that it only grows on the first calls.
+  thread_local std::vector<Found> found;
+  thread_local std::vector<Span> captures;
+  found.clear();
+  captures.clear();
+  unsigned pos = 0;
+  Span match;
+  while (found.size() < max_matches && SearchFrom(vm, text, pos, &match)) {
+    const unsigned first_capture = captures.size();
+    for (const Span& capture : vm.CaptureSpans())
+      captures.push_back({pos + capture.begin, pos + capture.end});
+    found.push_back({match, first_capture,
+                     static_cast<unsigned>(captures.size())});
+    pos = match.end > match.begin ? match.end : match.end + 1;
+  }
+
+  const auto captures_of = [&](const Found& f) {
+    return std::span<const Span>(captures).subspan(
+        f.first_capture, f.last_capture - f.first_capture);
+  };
+  size_t size = text.size();
+  for (const Found& f : found) {
+    size -= f.match.end - f.match.begin;
+    size += replacement.Size(f.match, captures_of(f));
+  }
+  out->resize(size);
+  char* p = out->data();
+  unsigned copied = 0;
+  for (const Found& f : found) {
+    p = Copy(text, copied, f.match.begin, p);
+    p = replacement.Expand(text, f.match, captures_of(f), p);
+    copied = f.match.end;
+  }
+  Copy(text, copied, text.size(), p);
+  return found.size();
+}
+
+}  // namespace
+
+bool ReplaceTemplate::Compile(std::string_view replacement) {
+  literals_.clear();
+  pieces_.clear();
+  for (size_t i = 0; i < replacement.size(); ++i) {
+    char c = replacement[i];
+    if (c == '$') {
+      if (i + 1 == replacement.size()) return false;
+      c = replacement[++i];
+      if (c >= '0' && c <= '9') {
+        pieces_.push_back({static_cast<unsigned>(c - '0'), 0, 0});
+        continue;
+      }
+      if (c != '$') return false;
+    }
+    // Consecutive literal bytes share a piece.
+    if (pieces_.empty() || pieces_.back().group != kLiteral) {
+      const unsigned begin = literals_.size();
+      pieces_.push_back({kLiteral, begin, begin});
+    }
+    literals_.push_back(c);
+    ++pieces_.back().end;
+  }
+  return true;
+}
+
+const Span* ReplaceTemplate::Group(unsigned group, const Span& match,
+                                   std::span<const Span> captures) {
+  if (group == 0) return &match;
+  return group <= captures.size() ? &captures[group - 1] : nullptr;
+}
+
+size_t ReplaceTemplate::Size(Span match,
+                             std::span<const Span> captures) const {
+  size_t size = 0;
+  for (const Piece& piece : pieces_) {
+    if (piece.group == kLiteral) {
+      size += piece.end - piece.begin;
+    } else if (const Span* span = Group(piece.group, match, captures)) {
+      size += span->end - span->begin;
+    }
+  }
+  return size;
+}
+
+char* ReplaceTemplate::Expand(std::string_view text, Span match,
+                              std::span<const Span> captures,
+                              char* out) const {
+  for (const Piece& piece : pieces_) {
+    if (piece.group == kLiteral) {
+      out = Copy(literals_, piece.begin, piece.end, out);
+    } else if (const Span* span = Group(piece.group, match, captures)) {
+      out = Copy(text, span->begin, span->end, out);
+    }
+  }
+  return out;
+}
+
+bool Replace(VM& vm, std::string_view text, const ReplaceTemplate& replacement,
+             std::string* out) {
+  return ReplaceImpl(vm, text, replacement, out, 1) == 1;
+}
+
+unsigned ReplaceAll(VM& vm, std::string_view text,
+                    const ReplaceTemplate& replacement, std::string* out) {
+  return ReplaceImpl(vm, text, replacement, out,
+                     std::numeric_limits<unsigned>::max());
+}
+
+bool Splitter::Next(std::string_view* piece) {
+  if (done_) return false;
+  Span match;
+  while (SearchFrom(vm_, text_, pos_, &match)) {
+    if (match.begin == match.end) {
+      pos_ = match.end + 1;
+      continue;
+    }
+    *piece = text_.substr(piece_begin_, match.begin - piece_begin_);
+    piece_begin_ = pos_ = match.end;
+    return true;
+  }
+  *piece = text_.substr(piece_begin_);
+  done_ = true;
+  return true;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,88 @@
+#ifndef RGVM_REWRITE_H
+#define RGVM_REWRITE_H
+
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "RGVM.h"
+
+namespace RGVM {
+
+// Replacement text such as "<$2:$1>", compiled once and expanded for every
+// match: $0 stands for the match, $1 to $9 for its captures and $$ for '$'.
+// A capture the match does not have expands to nothing.
+class ReplaceTemplate {
+ public:
+  // Returns false if |replacement| has a '$' followed by anything but a digit
+  // or another '$'.
+  bool Compile(std::string_view replacement);
+
+  // Size of the expansion for the match |match| of |text|, with |captures|.
+  size_t Size(Span match, std::span<const Span> captures) const;
+
+  // Writes the expansion to |out|, which must have room for Size() bytes, and
+  // returns the end of the expansion.
+  char* Expand(std::string_view text, Span match,
+               std::span<const Span> captures, char* out) const;
+
+ private:
+  static constexpr unsigned kLiteral = ~0u;
+
+  // Either the bytes [begin, end) of |literals_|, or capture |group|, $0
+  // being the match.
+  struct Piece {
+    unsigned group = kLiteral;
+    unsigned begin = 0, end = 0;
+  };
+
+  // Span of |group| in the match, or nullptr if it has none.
+  static const Span* Group(unsigned group, const Span& match,
+                           std::span<const Span> captures);
+
+  std::string literals_;
+  std::vector<Piece> pieces_;
+};
+
+// Writes |text| to |*out| with the first match of |vm| replaced by the
+// expansion of |replacement|. The output is sized once, before anything is
+// written. The matches are kept in a per-thread scratch, so once it and |*out|
+// are as large as the calls need, a call allocates nothing. Returns whether
+// there was a match.
+bool Replace(VM& vm, std::string_view text, const ReplaceTemplate& replacement,
+             std::string* out);
+
+// Same as above, but replaces every match, scanning on from the end of the
+// previous one; an empty match also lets the next byte through. Returns the
+// number of matches replaced.
+unsigned ReplaceAll(VM& vm, std::string_view text,
+                    const ReplaceTemplate& replacement, std::string* out);
+
+// Lazily splits a text into the pieces between the matches of a VM, searching
+// for the next match only when the next piece is asked for. Empty matches do
+// not split. The pieces point into the text, e.g.
+//
+//   Splitter splitter(vm, text);
+//   for (std::string_view piece; splitter.Next(&piece);) use(piece);
+class Splitter {
+ public:
+  // |vm| and |text| must outlive the splitter; searching with |vm| in the
+  // meantime is fine.
+  Splitter(VM& vm, std::string_view text) : vm_(vm), text_(text) {}
+
+  // Saves the next piece into |*piece|. Returns false past the last one.
+  bool Next(std::string_view* piece);
+
+ private:
+  VM& vm_;
+  std::string_view text_;
+  // Start of the next piece, and where to search for the next match.
+  unsigned piece_begin_ = 0;
+  unsigned pos_ = 0;
+  bool done_ = false;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_REWRITE_H
@@ -0,0 +1,138 @@
+#include "scan.h"
+
+#include <cassert>
+#include <utility>
+
+namespace RGVM {
+
+void AddClosure(const std::vector<Instruction>& program, unsigned pc,
+                bool greedy, SparseSet& set, std::vector<unsigned>& stack) {
+  // Iterative version of the recursive AddThread in RGVM.cpp: the preferred
+  // branch is pushed last so that it is fully explored first.
+  stack.push_back(pc);
+  while (!stack.empty()) {
+    pc = stack.back();
+    stack.pop_back();
+    if (set.Contains(pc)) continue;
+    set.Insert(pc);
+
+    const auto& instruction = program[pc];
+    switch (instruction.opcode) {
+      case Jmp:
+        stack.push_back(instruction.jmp);
+        break;
+      case Split:
+        stack.push_back(greedy ? instruction.y : instruction.x);
+        stack.push_back(greedy ? instruction.x : instruction.y);
+        break;
+      case Save:
+        stack.push_back(pc + 1);
+        break;
+      case Char:
+      case Any:
+      case Match:
+        break;
+      default:
+        assert(false);
+    }
+  }
+}
+
+bool MatchesAny(const std::vector<Instruction>& program, std::string_view text,
+                ScanScratch& scratch) {
+  scratch.Reset(program.size());
+  SparseSet* current = &scratch.current;
+  SparseSet* next = &scratch.next;
+  const unsigned match_pc = program.size() - 1;
+
+  // VM::Search never starts a thread at the end of the text: the last
+  // iteration only completes the running threads.
+  for (unsigned i = 0; i < text.size(); ++i) {
+    // The thread priority is irrelevant to whether there is a match.
+    AddClosure(program, 0, true, *current, scratch.stack);
+    if (current->Contains(match_pc)) return true;
+
+    next->Clear();
+    for (unsigned pc : *current) {
+      const auto& instruction = program[pc];
+      if (instruction.opcode == Any ||
+          (instruction.opcode == Char && text[i] == instruction.c)) {
+        AddClosure(program, pc + 1, true, *next, scratch.stack);
+      }
+    }
+    std::swap(current, next);
+  }
+  return current->Contains(match_pc);
+}
+
+bool FindMatchEnd(const std::vector<Instruction>& program,
+                  std::string_view text, bool greedy, ScanScratch& scratch,
+                  unsigned* end) {
+  scratch.Reset(program.size());
+  SparseSet* current = &scratch.current;
+  SparseSet* next = &scratch.next;
+  bool matched = false;
+
+  for (unsigned i = 0; i <= text.size(); ++i) {
+    // Threads started later have a lower priority than the running ones. Once
+    // a match is found no new thread is started: it could not start leftmost.
+    if (!matched && i < text.size())
+      AddClosure(program, 0, greedy, *current, scratch.stack);
+    if (current->Empty()) {
+      if (matched) break;
+      continue;
+    }
+
+    next->Clear();
+    for (unsigned pc : *current) {
+      const auto& instruction = program[pc];
+      if (instruction.opcode == Match) {
+        // Same as VM::Search: the surviving higher priority threads may still
+        // find a longer match, the lower priority ones are cut.
+        matched = true;
+        *end = i;
+        break;
+      }
+      if (i == text.size()) continue;
+      if (instruction.opcode == Any ||
+          (instruction.opcode == Char && text[i] == instruction.c)) {
+        AddClosure(program, pc + 1, greedy, *next, scratch.stack);
+      }
+    }
+    std::swap(current, next);
+  }
+  return matched;
+}
+
+bool FindMatchStart(const std::vector<Instruction>& reverse_program,
+                    std::string_view text, unsigned end, ScanScratch& scratch,
+                    unsigned* begin) {
+  scratch.Reset(reverse_program.size());
+  SparseSet* current = &scratch.current;
+  SparseSet* next = &scratch.next;
+  const unsigned match_pc = reverse_program.size() - 1;
+  bool found = false;
+
+  AddClosure(reverse_program, 0, true, *current, scratch.stack);
+  for (unsigned i = end;; --i) {
+    // VM::Search never starts a thread at the end of the text.
+    if (current->Contains(match_pc) && i < text.size()) {
+      found = true;
+      *begin = i;
+    }
+    if (i == 0 || current->Empty()) break;
+
+    next->Clear();
+    for (unsigned pc : *current) {
+      const auto& instruction = reverse_program[pc];
+      if (instruction.opcode == Any ||
+          (instruction.opcode == Char && text[i - 1] == instruction.c)) {
+        AddClosure(reverse_program, pc + 1, true, *next, scratch.stack);
+      }
+    }
+    std::swap(current, next);
+  }
+  return found;
+}
+
+}  // namespace RGVM
@@ -0,0 +1,102 @@
+#ifndef RGVM_SCAN_H
+#define RGVM_SCAN_H
+
+#include <string_view>
+#include <vector>
+
+#include "instructions.h"
+
+namespace RGVM {
+
+// Set of program counters with O(1) insertion, membership test and clear. The
+// elements are kept in insertion order, which is the thread priority order.
+class SparseSet {
+ public:
+  // Drops all the elements and makes room for program counters < |size|.
+  void Reset(unsigned size) {
+    if (sparse_.size() < size) {
+      sparse_.resize(size);
+      dense_.resize(size);
+    }
+    size_ = 0;
+  }
+
+  void Clear() { size_ = 0; }
+  bool Empty() const { return size_ == 0; }
+  unsigned Size() const { return size_; }
+
+  bool Contains(unsigned pc) const {
+    const unsigned i = sparse_[pc];
+    return i < size_ && dense_[i] == pc;
+  }
+
+  // |pc| must not be in the set yet.
+  void Insert(unsigned pc) {
+    sparse_[pc] = size_;
+    dense_[size_++] = pc;
+  }
+
+  // Bytes held by the set.
+  size_t MemoryUsage() const {
+    return (sparse_.capacity() + dense_.capacity()) * sizeof(unsigned);
+  }
+
+  std::vector<unsigned>::const_iterator begin() const {
+    return dense_.begin();
+  }
+  std::vector<unsigned>::const_iterator end() const {
+    return dense_.begin() + size_;
+  }
+
+ private:
+  std::vector<unsigned> sparse_;
+  std::vector<unsigned> dense_;
+  unsigned size_ = 0;
+};
+
+// Reusable memory of the capture-free scans below.
+struct ScanScratch {
+  SparseSet current, next;
+  std::vector<unsigned> stack;
+
+  void Reset(unsigned program_size) {
+    current.Reset(program_size);
+    next.Reset(program_size);
+    stack.clear();
+  }
+
+  size_t MemoryUsage() const {
+    return current.MemoryUsage() + next.MemoryUsage() +
+           stack.capacity() * sizeof(unsigned);
+  }
+};
+
+// Adds |pc| and everything reachable from it without consuming input to
+// |set|, in thread priority order. Threads are identified by their PC alone:
+// once a PC is in the set, lower priority threads reaching it are dropped.
+void AddClosure(const std::vector<Instruction>& program, unsigned pc,
+                bool greedy, SparseSet& set, std::vector<unsigned>& stack);
+
+// Returns whether |text| contains a match of |program|, i.e. whether
+// VM::Search would succeed. Threads are bare PCs and SAVE is skipped over, so
+// nothing is allocated once |scratch| has grown to the program size.
+bool MatchesAny(const std::vector<Instruction>& program, std::string_view text,
+                ScanScratch& scratch);
+
+// Runs |program| over |text| without tracking captures, and finds where the
+// match VM::Search would report ends: the match starting leftmost, and among
+// those the one the thread priority picks. Returns false if there is no match.
+bool FindMatchEnd(const std::vector<Instruction>& program,
+                  std::string_view text, bool greedy, ScanScratch& scratch,
+                  unsigned* end);
+
+// Runs the reverse program of CompileReverse() backwards over |text|, starting
+// at |end|, and finds the smallest |begin| such that text[begin, end) is
+// matched. Returns false if there is none.
+bool FindMatchStart(const std::vector<Instruction>& reverse_program,
+                    std::string_view text, unsigned end, ScanScratch& scratch,
+                    unsigned* begin);
+
+}  // namespace RGVM
+
+#endif  // RGVM_SCAN_H
@@ -0,0 +1,21 @@
+#include "simplify.h"
+
+#include <utility>
+#include <vector>
+
+#include "flat_ast.h"
+
+namespace RGVM {
+
+RegexPtr Simplify(const RegexPtr& rp) {
+  if (rp == nullptr) return rp;
+  std::vector<internal::FlatNode> nodes;
+  const int root = internal::Flatten(rp, nodes);
+  internal::Simplifier simplifier(std::move(nodes));
+  const int simplified = simplifier.Simplify(root);
+  // Nothing to simplify: keep the tree as is.
+  if (simplified == root) return rp;
+  return internal::Unflatten(simplifier.nodes(), simplified);
+}
+
+}  // namespace RGVM
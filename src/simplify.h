@@ -0,0 +1,20 @@
+#ifndef RGVM_SIMPLIFY_H
+#define RGVM_SIMPLIFY_H
+
+#include "parser.h"
+
+namespace RGVM {
+
+// Rewrites the AST rooted at |rp| into an equivalent one that compiles into a
+// smaller, less ambiguous program:
+// - adjacent duplicate alternatives are dropped, e.g. ab|ab|c => ab|c;
+// - single-character prefixes and suffixes are factored out of consecutive
+//   alternatives, e.g. abc|abd => ab(c|d), xz|yz => (x|y)z;
+// - concatenations are flattened into a single right-nested chain.
+// Parens are never moved across each other nor dropped, so the capture
+// numbering and the thread priorities are left intact.
+RegexPtr Simplify(const RegexPtr& rp);
+
+}  // namespace RGVM
+
+#endif  // RGVM_SIMPLIFY_H
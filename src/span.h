@@ -0,0 +1,14 @@
+#ifndef RGVM_SPAN_H
+#define RGVM_SPAN_H
+
+namespace RGVM {
+
+// Boundaries [begin, end) of a match in the searched string.
+struct Span {
+  unsigned begin = 0;
+  unsigned end = 0;
+};
+
+}  // namespace RGVM
+
+#endif  // RGVM_SPAN_H
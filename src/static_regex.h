@@ -0,0 +1,321 @@
+#ifndef RGVM_STATIC_REGEX_H
+#define RGVM_STATIC_REGEX_H
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "direct_vm.h"
+#include "flat_ast.h"
+#include "instructions.h"
+#include "parser.h"
+
+namespace RGVM {
+
+// String literal usable as a template argument, e.g. StaticRegex<"a+b">.
+template <size_t N>
+struct FixedString {
+  char data[N] = {};
+
+  constexpr FixedString(const char (&s)[N]) {
+    for (size_t i = 0; i < N; ++i) data[i] = s[i];
+  }
+
+  constexpr size_t size() const { return N - 1; }
+};
+
+namespace internal {
+
+// Every character adds at most one leaf and one Alt or Concat node.
+template <size_t N>
+struct StaticAst {
+  FlatNode nodes[2 * N + 2] = {};
+  int size = 0;
+  // -1 if the pattern is invalid.
+  int root = -1;
+};
+
+// constexpr twin of Parse(): same grammar, and like Parse() it skips the
+// leading and trailing spaces and rejects anything else left after the
+// regexp.
+template <size_t N>
+class StaticParser {
+ public:
+  constexpr explicit StaticParser(const FixedString<N>& pattern)
+      : pattern_(pattern) {}
+
+  constexpr StaticAst<N> Parse() {
+    SkipSpaces();
+    ast_.root = ParseAlt();
+    SkipSpaces();
+    if (pos_ != pattern_.size()) ast_.root = -1;
+    return ast_;
+  }
+
+ private:
+  static constexpr bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' ||
+           c == '\r';
+  }
+
+  constexpr void SkipSpaces() {
+    while (pos_ < pattern_.size() && IsSpace(pattern_.data[pos_])) ++pos_;
+  }
+
+  static constexpr bool IsAlnum(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+           (c >= 'A' && c <= 'Z');
+  }
+
+  // Returns the next character, or 0 at the end.
+  constexpr char Peek() const {
+    return pos_ < pattern_.size() ? pattern_.data[pos_] : 0;
+  }
+
+  constexpr int Add(RegexType type, char c, int left, int right) {
+    ast_.nodes[ast_.size] = {type, c, left, right};
+    return ast_.size++;
+  }
+
+  // The alternatives below backtrack the same way Spirit does: the longer
+  // rule is tried first, and everything it consumed is dropped if it fails.
+  constexpr int ParseAlt() {
+    const int left = ParseConcat();
+    if (left < 0) return -1;
+    const size_t pos = pos_;
+    const int size = ast_.size;
+    if (Peek() == '|') {
+      ++pos_;
+      const int right = ParseAlt();
+      if (right >= 0) return Add(Alt, 0, left, right);
+    }
+    pos_ = pos;
+    ast_.size = size;
+    return left;
+  }
+
+  constexpr int ParseConcat() {
+    const int left = ParseRepeat();
+    if (left < 0) return -1;
+    const size_t pos = pos_;
+    const int size = ast_.size;
+    const int right = ParseConcat();
+    if (right >= 0) return Add(Concat, 0, left, right);
+    pos_ = pos;
+    ast_.size = size;
+    return left;
+  }
+
+  constexpr int ParseRepeat() {
+    const int single = ParseSingle();
+    if (single < 0) return -1;
+    switch (Peek()) {
+      case '*':
+        ++pos_;
+        return Add(Star, 0, single, -1);
+      case '+':
+        ++pos_;
+        return Add(Plus, 0, single, -1);
+      case '?':
+        ++pos_;
+        return Add(Quest, 0, single, -1);
+      default:
+        return single;
+    }
+  }
+
+  constexpr int ParseSingle() {
+    const char c = Peek();
+    if (c == '(') {
+      ++pos_;
+      const int inner = ParseAlt();
+      if (inner < 0 || Peek() != ')') return -1;
+      ++pos_;
+      return Add(Paren, 0, inner, -1);
+    }
+    if (IsAlnum(c)) {
+      ++pos_;
+      return Add(Lit, c, -1, -1);
+    }
+    if (c == '.') {
+      ++pos_;
+      return Add(Dot, 0, -1, -1);
+    }
+    return -1;
+  }
+
+  const FixedString<N>& pattern_;
+  size_t pos_ = 0;
+  StaticAst<N> ast_;
+};
+
+template <size_t N>
+constexpr StaticAst<N> ParseStatic(const FixedString<N>& pattern) {
+  return StaticParser<N>(pattern).Parse();
+}
+
+// Copies the tree rooted at |node| into |out|. Simplifying never grows the
+// tree, so it always fits; if it did not, the out of bounds write would fail
+// the compilation.
+template <size_t N>
+constexpr int CopyStatic(const std::vector<FlatNode>& nodes, int node,
+                         StaticAst<N>& out) {
+  if (node < 0) return -1;
+  FlatNode n = nodes[node];
+  n.left = CopyStatic(nodes, n.left, out);
+  n.right = CopyStatic(nodes, n.right, out);
+  out.nodes[out.size] = n;
+  return out.size++;
+}
+
+// Runs the Simplifier of Simplify() on |ast|.
+template <size_t N>
+constexpr StaticAst<N> SimplifyStatic(const StaticAst<N>& ast) {
+  if (ast.root < 0) return ast;
+  Simplifier simplifier(
+      std::vector<FlatNode>(ast.nodes, ast.nodes + ast.size));
+  const int root = simplifier.Simplify(ast.root);
+  StaticAst<N> simplified;
+  simplified.root = CopyStatic(simplifier.nodes(), root, simplified);
+  return simplified;
+}
+
+// Cases |k| to |k| + 63 of StaticProgram::Dispatch().
+#define RGVM_STATIC_CASE(k)                                     \
+  case (k):                                                     \
+    if constexpr (kBase + (k) < kSize)                          \
+      return f(std::integral_constant<unsigned, kBase + (k)>()); \
+    return false;
+#define RGVM_STATIC_CASES_4(k)                    \
+  RGVM_STATIC_CASE(k) RGVM_STATIC_CASE((k) + 1) \
+  RGVM_STATIC_CASE((k) + 2) RGVM_STATIC_CASE((k) + 3)
+#define RGVM_STATIC_CASES_16(k)                         \
+  RGVM_STATIC_CASES_4(k) RGVM_STATIC_CASES_4((k) + 4) \
+  RGVM_STATIC_CASES_4((k) + 8) RGVM_STATIC_CASES_4((k) + 12)
+#define RGVM_STATIC_CASES_64(k)                            \
+  RGVM_STATIC_CASES_16(k) RGVM_STATIC_CASES_16((k) + 16) \
+  RGVM_STATIC_CASES_16((k) + 32) RGVM_STATIC_CASES_16((k) + 48)
+
+// Program of |kPattern|, computed by the compiler. The AST is simplified and
+// compiled by the very code VM::Compile() runs, see flat_ast.h, so both
+// compile the same program.
+template <FixedString kPattern>
+struct StaticProgram {
+  static constexpr auto kParsed = ParseStatic(kPattern);
+  static_assert(kParsed.root >= 0, "invalid regular expression");
+  static constexpr auto kAst = SimplifyStatic(kParsed);
+
+  static constexpr unsigned kSize = CountNodes(kAst.nodes, kAst.root) + 1;
+  static constexpr unsigned kNumSlots =
+      2 * CountParenNodes(kAst.nodes, kAst.root);
+
+  static constexpr std::array<Instruction, kSize> Compile() {
+    std::array<Instruction, kSize> program{};
+    CompileState st;
+    CompileNodes(kAst.nodes, kAst.root, st, program);
+    program[kSize - 1] = CreateInstr(Match, 0, 0, 0, 0, 0);
+    return program;
+  }
+
+  static constexpr std::array<Instruction, kSize> kInstructions =
+      Compile();
+
+  // DirectVM interface, with one function per instruction.
+  using Thread = DirectThread<kNumSlots>;
+  using ThreadList = DirectThreadList<kSize, kNumSlots>;
+
+  static void AddThread(ThreadList& list, bool greedy, unsigned pc,
+                        unsigned pos, Thread thread) {
+    Dispatch(pc, [&](auto kPc) {
+      AddThreadAt<kPc>(list, greedy, pos, thread);
+      return false;
+    });
+  }
+
+  static bool Step(unsigned pc, std::string_view text, unsigned i,
+                   bool greedy, Thread& thread, ThreadList& next) {
+    return Dispatch(pc, [&](auto kPc) {
+      return StepAt<kPc>(text, i, greedy, thread, next);
+    });
+  }
+
+ private:
+  // Calls |f| with the runtime |pc| turned into a compile time constant. The
+  // PCs are switched over 64 at a time, |pc| >= |kBase|: each block is one
+  // jump table, and a larger program chains the blocks.
+  template <unsigned kBase = 0, typename F>
+  static bool Dispatch(unsigned pc, F&& f) {
+    switch (pc - kBase) {
+      RGVM_STATIC_CASES_64(0)
+      default:
+        if constexpr (kBase + 64 < kSize) return Dispatch<kBase + 64>(pc, f);
+        return false;
+    }
+  }
+
+  // Same as AddThread() in RGVM.cpp, resolved at compile time.
+  template <unsigned kPc>
+  static void AddThreadAt(ThreadList& list, bool greedy, unsigned pos,
+                          Thread thread) {
+    if (!list.Visit(kPc)) return;
+    constexpr Instruction kInstruction = kInstructions[kPc];
+    if constexpr (kInstruction.opcode == Jmp) {
+      AddThreadAt<kInstruction.jmp>(list, greedy, pos, thread);
+    } else if constexpr (kInstruction.opcode == Split) {
+      if (greedy) {
+        AddThreadAt<kInstruction.x>(list, greedy, pos, thread);
+        AddThreadAt<kInstruction.y>(list, greedy, pos, thread);
+      } else {
+        AddThreadAt<kInstruction.y>(list, greedy, pos, thread);
+        AddThreadAt<kInstruction.x>(list, greedy, pos, thread);
+      }
+    } else if constexpr (kInstruction.opcode == Save) {
+      thread.Save(kInstruction.saved, pos);
+      AddThreadAt<kPc + 1>(list, greedy, pos, thread);
+    } else {
+      list.Push(kPc, thread);
+    }
+  }
+
+  template <unsigned kPc>
+  static bool StepAt(std::string_view text, unsigned i, bool greedy,
+                     Thread& thread, ThreadList& next) {
+    constexpr Instruction kInstruction = kInstructions[kPc];
+    if constexpr (kInstruction.opcode == Match) {
+      return true;
+    } else if constexpr (kInstruction.opcode == Char ||
+                         kInstruction.opcode == Any) {
+      bool consumed = i < text.size();
+      if constexpr (kInstruction.opcode == Char)
+        consumed = consumed && text[i] == kInstruction.c;
+      if (consumed) {
+        ++thread.end;
+        AddThreadAt<kPc + 1>(next, greedy, i + 1, thread);
+      }
+    }
+    return false;
+  }
+};
+
+}  // namespace internal
+
+#undef RGVM_STATIC_CASES_64
+#undef RGVM_STATIC_CASES_16
+#undef RGVM_STATIC_CASES_4
+#undef RGVM_STATIC_CASE
+
+// Regular expression parsed and compiled by the C++ compiler: no parsing nor
+// compilation at runtime, and a DirectVM specialized for the program, with
+// one function per instruction the optimizer can inline. Same semantics and
+// API as VM::Search, e.g.
+//
+//   StaticRegex<"(23*)4(5+)"> regex;
+//   if (regex.Search(text)) use(regex.Captures());
+template <FixedString kPattern>
+using StaticRegex = DirectVM<internal::StaticProgram<kPattern>>;
+
+}  // namespace RGVM
+
+#endif  // RGVM_STATIC_REGEX_H
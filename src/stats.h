@@ -0,0 +1,37 @@
+#ifndef RGVM_STATS_H
+#define RGVM_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace RGVM {
+
+// Execution engine that served a search. Auto lets the planner pick one per
+// search, see VM::SetEngine().
+enum class Engine { Auto, Pike, TwoPass, OnePass, AhoCorasick };
+
+// Execution counters of a single VM::Search. Only collected when enabled on the
+// VM, see VM::EnableStats() and VM::SetStatsCallback().
+struct SearchStats {
+  Engine engine = Engine::Pike;
+  // Instructions dispatched, including the ones followed by AddThread.
+  uint64_t instructions = 0;
+  // Threads ever enqueued, and the most threads alive at the same time.
+  uint64_t total_threads = 0;
+  uint64_t peak_threads = 0;
+  // Executed Split and Save instructions, each of which forks the thread.
+  uint64_t split_forks = 0;
+  uint64_t save_forks = 0;
+  // Input bytes that were never handed to the engine thanks to a prefilter.
+  uint64_t prefilter_skipped_bytes = 0;
+  // Wall time of the search.
+  std::chrono::nanoseconds elapsed{0};
+};
+
+// Invoked at the end of every search with the collected stats.
+using StatsCallback = std::function<void(const SearchStats&)>;
+
+}  // namespace RGVM
+
+#endif  // RGVM_STATS_H
@@ -0,0 +1,126 @@
+#include "stream.h"
+
+namespace RGVM {
+
+bool StreamMatcher::Compile(const std::string& regexp) {
+  RegexPtr rp;
+  compiled_ = RGVM::Parse(regexp, rp);
+  if (compiled_) instructions_ = RGVM::Compile(Simplify(rp));
+  Reset();
+  return compiled_;
+}
+
+void StreamMatcher::SetGreedy(bool greedy) {
+  greedy_ = greedy;
+  Reset();
+}
+
+void StreamMatcher::Reset() {
+  buffer_.clear();
+  buffer_offset_ = 0;
+  buffer_skip_ = 0;
+  received_ = 0;
+  pos_ = 0;
+  matched_ = false;
+  current_.Reset(instructions_.size());
+  next_.Reset(instructions_.size());
+  current_begins_.resize(instructions_.size());
+  next_begins_.resize(instructions_.size());
+}
+
+void StreamMatcher::Feed(std::string_view chunk,
+                         std::vector<StreamMatch>* matches) {
+  if (!compiled_) return;
+  buffer_.append(chunk);
+  received_ += chunk.size();
+  Scan(matches);
+}
+
+void StreamMatcher::Finish(std::vector<StreamMatch>* matches) {
+  if (!compiled_) return;
+  for (;;) {
+    Scan(matches);
+    // Same as the last iteration of FindMatchEnd(): the running threads are
+    // completed, and no thread starts at the end of the text.
+    for (unsigned pc : current_) {
+      if (instructions_[pc].opcode == Match) {
+        matched_ = true;
+        match_ = {current_begins_[pc], received_};
+        break;
+      }
+    }
+    current_.Clear();
+    if (!matched_) break;
+    Restart(matches);
+  }
+  Reset();
+}
+
+void StreamMatcher::AddThreads(SparseSet* set, std::vector<uint64_t>& begins,
+                               unsigned pc, uint64_t begin) {
+  const unsigned size = set->Size();
+  AddClosure(instructions_, pc, greedy_, *set, stack_);
+  for (auto it = set->begin() + size; it != set->end(); ++it)
+    begins[*it] = begin;
+}
+
+void StreamMatcher::Restart(std::vector<StreamMatch>* matches) {
+  matches->push_back(match_);
+  pos_ = match_.end > match_.begin ? match_.end : match_.end + 1;
+  matched_ = false;
+  current_.Clear();
+}
+
+void StreamMatcher::Scan(std::vector<StreamMatch>* matches) {
+  // Same loop as FindMatchEnd(), see there, but a match is final as soon as
+  // no thread is left, without waiting for the next byte.
+  for (;;) {
+    if (matched_ && current_.Empty()) {
+      Restart(matches);
+      continue;
+    }
+    if (pos_ == received_) {
+      // A match of the highest priority thread cuts all the others, whatever
+      // the next byte is.
+      const unsigned first = current_.Empty() ? 0 : *current_.begin();
+      if (!current_.Empty() && instructions_[first].opcode == Match) {
+        matched_ = true;
+        match_ = {current_begins_[first], pos_};
+        current_.Clear();
+        continue;
+      }
+      break;
+    }
+
+    if (!matched_) AddThreads(&current_, current_begins_, 0, pos_);
+    const char c = buffer_[pos_ - buffer_offset_];
+    next_.Clear();
+    for (unsigned pc : current_) {
+      const auto& instruction = instructions_[pc];
+      if (instruction.opcode == Match) {
+        matched_ = true;
+        match_ = {current_begins_[pc], pos_};
+        break;
+      }
+      if (instruction.opcode == Any ||
+          (instruction.opcode == Char && c == instruction.c)) {
+        AddThreads(&next_, next_begins_, pc + 1, current_begins_[pc]);
+      }
+    }
+    std::swap(current_, next_);
+    std::swap(current_begins_, next_begins_);
+    ++pos_;
+  }
+
+  // A restart goes back to the end of the pending match at most. The dead
+  // bytes are dropped once they make up half of the buffer, so that every
+  // byte is moved O(1) times.
+  buffer_skip_ = (matched_ ? match_.end : pos_) - buffer_offset_;
+  if (buffer_skip_ > buffer_.size() / 2) {
+    buffer_.erase(0, buffer_skip_);
+    buffer_offset_ += buffer_skip_;
+    buffer_skip_ = 0;
+  }
+}
+
+}  // namespace RGVM
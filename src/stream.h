@@ -0,0 +1,199 @@
+#ifndef RGVM_STREAM_H
+#define RGVM_STREAM_H
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "RGVM.h"
+
+namespace RGVM {
+
+// Boundaries [begin, end) of a match in a stream, counted from its first
+// byte.
+struct StreamMatch {
+  uint64_t begin = 0;
+  uint64_t end = 0;
+};
+
+// Finds the matches of a regexp in a text received one chunk at a time, the
+// same ones as calling VM::Search over the whole text again and again, each
+// time from the end of the previous match (one byte further after an empty
+// match), as ReplaceAll() does. The capture-free forward scan of
+// FindMatchEnd() is run over the chunks as they come; a match is reported as
+// soon as no running thread can change it. Only the bytes a restart after a
+// pending match may need are kept.
+class StreamMatcher {
+ public:
+  // Same as VM::Compile(). Resets the stream.
+  bool Compile(const std::string& regexp);
+
+  // Same as VM::SetGreedy(). Resets the stream.
+  void SetGreedy(bool greedy);
+
+  // Starts a new stream.
+  void Reset();
+
+  // Scans |chunk|, the next bytes of the stream, and appends the matches that
+  // became final to |*matches|.
+  void Feed(std::string_view chunk, std::vector<StreamMatch>* matches);
+
+  // Ends the stream, and appends the remaining matches to |*matches|. The
+  // next Feed() starts a new stream.
+  void Finish(std::vector<StreamMatch>* matches);
+
+  // Bytes of the stream kept for a restart.
+  size_t BufferedBytes() const { return buffer_.size() - buffer_skip_; }
+
+ private:
+  // Runs the scan over the buffered bytes.
+  void Scan(std::vector<StreamMatch>* matches);
+
+  // Reports the pending match, and starts a new search after it.
+  void Restart(std::vector<StreamMatch>* matches);
+
+  // Adds the closure of |pc| to |*set|, the threads it adds starting at
+  // |begin|.
+  void AddThreads(SparseSet* set, std::vector<uint64_t>& begins, unsigned pc,
+                  uint64_t begin);
+
+  bool compiled_ = false;
+  bool greedy_ = true;
+  std::vector<Instruction> instructions_;
+
+  // Bytes [buffer_offset_ + buffer_skip_, received_) of the stream.
+  std::string buffer_;
+  uint64_t buffer_offset_ = 0;
+  size_t buffer_skip_ = 0;
+  uint64_t received_ = 0;
+  // Position of the next byte to scan.
+  uint64_t pos_ = 0;
+
+  // Match of the current search, final once no thread is left.
+  bool matched_ = false;
+  StreamMatch match_;
+
+  SparseSet current_, next_;
+  // Start of the thread at every PC of |current_| and |next_|.
+  std::vector<uint64_t> current_begins_, next_begins_;
+  std::vector<unsigned> stack_;
+};
+
+// Coroutine producing the matches of a stream lazily, for asynchronous
+// pipelines: it suspends whenever it needs the next chunk until the chunk
+// arrives, and hands every match to the consumer awaiting Next() as soon as
+// it is final. See MatchStream().
+class MatchGenerator {
+ public:
+  struct promise_type {
+    MatchGenerator get_return_object() {
+      return MatchGenerator(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    // Runs on the first Next().
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    auto final_suspend() noexcept { return ResumeConsumer{}; }
+    auto yield_value(StreamMatch match) noexcept {
+      current = match;
+      return ResumeConsumer{};
+    }
+    void return_void() noexcept { current.reset(); }
+    // Rethrown to the consumer by Next().
+    void unhandled_exception() noexcept {
+      current.reset();
+      exception = std::current_exception();
+    }
+
+    std::optional<StreamMatch> current;
+    std::exception_ptr exception;
+    // Coroutine awaiting Next().
+    std::coroutine_handle<> consumer;
+  };
+
+  MatchGenerator(MatchGenerator&& other) noexcept
+      : handle_(std::exchange(other.handle_, nullptr)) {}
+  MatchGenerator& operator=(MatchGenerator&& other) noexcept {
+    std::swap(handle_, other.handle_);
+    return *this;
+  }
+  MatchGenerator(const MatchGenerator&) = delete;
+  MatchGenerator& operator=(const MatchGenerator&) = delete;
+
+  ~MatchGenerator() {
+    if (handle_) handle_.destroy();
+  }
+
+  // co_await Next() returns the next match, or nullopt at the end of the
+  // stream. Rethrows what the generator threw, e.g. the read of a chunk; the
+  // stream then ends.
+  auto Next() { return NextAwaiter{handle_}; }
+
+ private:
+  // Transfers control back to the consumer when the generator suspends.
+  struct ResumeConsumer {
+    bool await_ready() noexcept { return false; }
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<promise_type> generator) noexcept {
+      return generator.promise().consumer;
+    }
+    void await_resume() noexcept {}
+  };
+
+  struct NextAwaiter {
+    std::coroutine_handle<promise_type> generator;
+
+    bool await_ready() noexcept { return generator.done(); }
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> consumer) noexcept {
+      generator.promise().consumer = consumer;
+      return generator;
+    }
+    std::optional<StreamMatch> await_resume() {
+      if (auto exception = std::exchange(generator.promise().exception, {}))
+        std::rethrow_exception(exception);
+      if (generator.done()) return std::nullopt;
+      return generator.promise().current;
+    }
+  };
+
+  explicit MatchGenerator(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Yields the matches of |matcher| in the stream read by |read|, as they
+// become final. co_await read() must produce the next chunk as anything
+// convertible to std::string_view and valid until the next read, e.g. a
+// std::string; an empty chunk ends the stream. |matcher| is reset first and
+// must outlive the generator, e.g.
+//
+//   MatchGenerator matches =
+//       MatchStream(matcher, [&] { return socket.ReadChunk(); });
+//   while (auto match = co_await matches.Next()) use(*match);
+template <typename Read>
+MatchGenerator MatchStream(StreamMatcher& matcher, Read read) {
+  matcher.Reset();
+  std::vector<StreamMatch> matches;
+  for (bool end = false; !end;) {
+    const auto chunk = co_await read();
+    const std::string_view bytes = chunk;
+    end = bytes.empty();
+    if (end) {
+      matcher.Finish(&matches);
+    } else {
+      matcher.Feed(bytes, &matches);
+    }
+    for (const StreamMatch& match : matches) co_yield match;
+    matches.clear();
+  }
+}
+
+}  // namespace RGVM
+
+#endif  // RGVM_STREAM_H
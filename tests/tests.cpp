@@ -2,12 +2,39 @@
 // Created by William Liu on 2021-04-08.
 //
 
+#include <zlib.h>
+
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+
 #include "RGVM.h"
+#include "bundle.h"
+#include "dfa.h"
+#include "flat_ast.h"
+#include "gzip_scan.h"
+#include "incremental.h"
+#include "matrix.h"
+#include "rewrite.h"
+#include "rules.h"
+#include "stream.h"
+#include "static_regex.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 using namespace RGVM;
 
+// RGVM_TEST_JIT=1 runs the whole suite with the JIT on in every VM, see
+// CMakeLists.txt.
+const bool kJitByDefault = [] {
+  const char* value = std::getenv("RGVM_TEST_JIT");
+  const bool enable = value && std::string_view(value) == "1";
+  VM::SetJitByDefault(enable);
+  return enable;
+}();
+
 TEST(RGVM, ComparisonOperator_NULL) {
   RegexPtr a, b;
   EXPECT_TRUE(a == b);
@@ -245,6 +272,25 @@ TEST(RGVM, Compiler_Paren) {
                                      SaveInstr(1), MatchInstr()));
 }
 
+TEST(RGVM, Compiler_Reverse) {
+  RegexPtr a;
+  EXPECT_TRUE(Parse("(ab|c)+d", a));
+  const auto instructions = CompileReverse(a);
+  // I0: CHAR 'd'
+  // I1: SPLIT I2 I5
+  // I2: CHAR 'b'
+  // I3: CHAR 'a'
+  // I4: JMP I6
+  // I5: CHAR 'c'
+  // I6: SPLIT I1 I7
+  // I7: MATCH
+  ASSERT_THAT(instructions,
+              ::testing::ElementsAre(CharInstr('d'), SplitInstr(2, 5),
+                                     CharInstr('b'), CharInstr('a'),
+                                     JmpInstr(6), CharInstr('c'),
+                                     SplitInstr(1, 7), MatchInstr()));
+}
+
 TEST(RGVM, BadRegexp) {
   VM vm;
   const std::string bad_regexp = "(a";
@@ -415,6 +461,1267 @@ TEST(RGVM, Search_MultipleLazyCapture_2) {
   ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("23333", ""));
 }
 
+TEST(RGVM, Stats_DisabledByDefault) {
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(23+)"));
+  EXPECT_TRUE(vm.Search("a222223333b"));
+  EXPECT_EQ(vm.Stats().instructions, 0u);
+  EXPECT_EQ(vm.Stats().total_threads, 0u);
+}
+
+TEST(RGVM, Stats_Counters) {
+  VM vm;
+  vm.EnableStats(true);
+  vm.SetEngine(Engine::Pike);
+  EXPECT_TRUE(vm.Compile("(23+)"));
+  EXPECT_TRUE(vm.Search("a222223333b"));
+  const SearchStats& stats = vm.Stats();
+  EXPECT_EQ(stats.engine, Engine::Pike);
+  EXPECT_GT(stats.instructions, 0u);
+  EXPECT_GE(stats.total_threads, stats.peak_threads);
+  EXPECT_GT(stats.peak_threads, 0u);
+  EXPECT_GT(stats.split_forks, 0u);
+  EXPECT_GT(stats.save_forks, 0u);
+  // The prefilter skips to the "23" prefix.
+  EXPECT_EQ(stats.prefilter_skipped_bytes, 5u);
+
+  // Stats are reset on every search.
+  const uint64_t instructions = stats.instructions;
+  EXPECT_TRUE(vm.Search("a222223333b"));
+  EXPECT_EQ(vm.Stats().instructions, instructions);
+}
+
+TEST(RGVM, Stats_Callback) {
+  VM vm;
+  unsigned calls = 0;
+  uint64_t splits = 0;
+  vm.SetStatsCallback([&](const SearchStats& stats) {
+    ++calls;
+    splits = stats.split_forks;
+  });
+  EXPECT_TRUE(vm.Compile("ab*"));
+  EXPECT_TRUE(vm.Search("aabbb"));
+  EXPECT_FALSE(vm.Search("ccc"));
+  EXPECT_EQ(calls, 2u);
+  EXPECT_EQ(splits, 0u);
+
+  vm.SetStatsCallback(nullptr);
+  EXPECT_TRUE(vm.Search("aabbb"));
+  EXPECT_EQ(calls, 2u);
+}
+
+TEST(RGVM, Limits_Unlimited) {
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(23+)"));
+  EXPECT_EQ(vm.Search("a222223333b", SearchLimits()), SearchStatus::Match);
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("23333"));
+  EXPECT_EQ(vm.Search("a22222b", SearchLimits()), SearchStatus::NoMatch);
+}
+
+TEST(RGVM, Limits_MaxSteps) {
+  VM vm;
+  SearchLimits limits;
+  limits.max_steps = 10;
+  EXPECT_TRUE(vm.Compile("(23+)"));
+  EXPECT_EQ(vm.Search("a222223333b", limits), SearchStatus::BudgetExceeded);
+  EXPECT_TRUE(vm.Captures().empty());
+}
+
+TEST(RGVM, Limits_MaxThreads) {
+  VM vm;
+  SearchLimits limits;
+  limits.max_threads = 4;
+  EXPECT_TRUE(vm.Compile("a*a*a*b"));
+  EXPECT_EQ(vm.Search("aaaaaaaa", limits), SearchStatus::BudgetExceeded);
+  limits.max_threads = 0;
+  EXPECT_EQ(vm.Search("aaaaaaaa", limits), SearchStatus::NoMatch);
+
+  // At the second 'a', the 5 threads of the first one are still alive while
+  // the closure of the second one is added.
+  EXPECT_TRUE(vm.Compile("a(b|c|d|e|f)"));
+  limits.max_threads = 9;
+  EXPECT_EQ(vm.Search("aa", limits), SearchStatus::BudgetExceeded);
+  limits.max_threads = 10;
+  EXPECT_EQ(vm.Search("aa", limits), SearchStatus::NoMatch);
+}
+
+TEST(RGVM, Limits_MaxCaptureBytes) {
+  VM vm;
+  SearchLimits limits;
+  limits.max_capture_bytes = 1;
+  EXPECT_TRUE(vm.Compile("(a)"));
+  EXPECT_EQ(vm.Search("bba", limits), SearchStatus::BudgetExceeded);
+  EXPECT_TRUE(vm.Compile("a"));
+  EXPECT_EQ(vm.Search("bba", limits), SearchStatus::Match);
+}
+
+TEST(RGVM, Limits_Deadline) {
+  VM vm;
+  SearchLimits limits;
+  limits.deadline = std::chrono::steady_clock::now();
+  EXPECT_TRUE(vm.Compile("ab"));
+  EXPECT_EQ(vm.Search("aabbb", limits), SearchStatus::BudgetExceeded);
+}
+
+TEST(RGVM, Limits_Cancel) {
+  VM vm;
+  std::atomic<bool> cancel{true};
+  SearchLimits limits;
+  limits.cancel = &cancel;
+  EXPECT_TRUE(vm.Compile("ab"));
+  EXPECT_EQ(vm.Search("aabbb", limits), SearchStatus::Cancelled);
+  cancel = false;
+  EXPECT_EQ(vm.Search("aabbb", limits), SearchStatus::Match);
+}
+
+TEST(RGVM, Search_AmbiguousAlternation) {
+  // The higher priority alternative survives the shorter match.
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(ab*|a)"));
+  EXPECT_TRUE(vm.Search("xabbb"));
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("abbb"));
+  EXPECT_TRUE(vm.Compile("(a|ab*)"));
+  EXPECT_TRUE(vm.Search("xabbb"));
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("a"));
+}
+
+TEST(RGVM, Search_Leftmost) {
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(abcd|c)"));
+  EXPECT_TRUE(vm.Search("abcd"));
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("abcd"));
+  EXPECT_EQ(vm.MatchSpan().begin, 0u);
+  EXPECT_EQ(vm.MatchSpan().end, 4u);
+}
+
+TEST(RGVM, Search_CapturesClearedOnFailure) {
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(a+)"));
+  EXPECT_TRUE(vm.Search("baab"));
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("aa"));
+  EXPECT_FALSE(vm.Search("bbb"));
+  EXPECT_TRUE(vm.Captures().empty());
+}
+
+TEST(RGVM, Search_NestedStarIsLinear) {
+  // Used to grow the thread queue exponentially with the input.
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(a*b)*c"));
+  EXPECT_FALSE(vm.Search(std::string(2000, 'a') + "b"));
+  EXPECT_TRUE(vm.Search(std::string(2000, 'a') + "bc"));
+  EXPECT_EQ(vm.Captures().size(), 1u);
+}
+
+// Searches every subject with both the plain VM and the reverse search, and
+// expects the same outcome, span and captures.
+void ExpectSameAsReverseSearch(const std::vector<std::string>& regexps,
+                               const std::vector<std::string>& subjects) {
+  for (bool greedy : {true, false}) {
+    for (const auto& regexp : regexps) {
+      VM forward, reverse;
+      forward.SetGreedy(greedy);
+      reverse.SetGreedy(greedy);
+      forward.SetEngine(Engine::Pike);
+      reverse.SetEngine(Engine::TwoPass);
+      ASSERT_TRUE(forward.Compile(regexp));
+      ASSERT_TRUE(reverse.Compile(regexp));
+      for (const auto& subject : subjects) {
+        SCOPED_TRACE(regexp + " ~ " + subject + (greedy ? "" : " (lazy)"));
+        const bool ok = forward.Search(subject);
+        ASSERT_EQ(reverse.Search(subject), ok);
+        EXPECT_EQ(reverse.Captures(), forward.Captures());
+        if (!ok) continue;
+        EXPECT_EQ(reverse.MatchSpan().begin, forward.MatchSpan().begin);
+        EXPECT_EQ(reverse.MatchSpan().end, forward.MatchSpan().end);
+      }
+    }
+  }
+}
+
+TEST(RGVM, ReverseSearch_SameAsForward) {
+  ExpectSameAsReverseSearch(
+      {"ab", "ab*", "ab+", "ab?", "a.", "(23+)", "(233*)", "(2+3)", "(2*3)",
+       "(23+)4(5+)", "(23*)4(5*)", "(a|ab)(c|bcd)(d*)", "(ab*|a)", "(a|ab*)",
+       "(abcd|c)", "a*", "(a*)(b*)", "((a)|b)+", "(.*)b(.*)", "(a+)|(b+)",
+       "x(a|b)*y", "(aa|a)(aa|a)"},
+      {"", "a", "b", "ab", "aabbb", "a222223333b", "a22222333345555555b",
+       "abcd", "xabbb", "aaaa", "babab", "xaybyxabay", "ccc", "aaab"});
+}
+
+TEST(RGVM, ReverseSearch_NoCaptures) {
+  VM vm;
+  vm.SetEngine(Engine::TwoPass);
+  EXPECT_TRUE(vm.Compile("b+c"));
+  EXPECT_TRUE(vm.Search("aabbbcbc"));
+  EXPECT_TRUE(vm.Captures().empty());
+  EXPECT_EQ(vm.MatchSpan().begin, 2u);
+  EXPECT_EQ(vm.MatchSpan().end, 6u);
+}
+
+TEST(RGVM, Matches_SameAsSearch) {
+  const std::vector<std::string> regexps = {
+      "ab", "ab*", "a.", "(23+)4(5+)", "(a|ab)(c|bcd)(d*)", "a*", "(a*)(b*)",
+      "x(a|b)*y", "(.*)b(.*)", "a|bc|d"};
+  const std::vector<std::string> subjects = {
+      "", "a", "b", "ab", "aabbb", "a22222333345555555b", "abcd", "xaybyxabay",
+      "ccc", "bd"};
+  for (const auto& regexp : regexps) {
+    VM vm;
+    ASSERT_TRUE(vm.Compile(regexp));
+    for (const auto& subject : subjects) {
+      SCOPED_TRACE(regexp + " ~ " + subject);
+      const bool ok = vm.Matches(subject);
+      EXPECT_EQ(vm.Search(subject), ok);
+    }
+  }
+}
+
+TEST(RGVM, Matches_LeavesCapturesUntouched) {
+  VM vm;
+  EXPECT_TRUE(vm.Compile("(23+)"));
+  EXPECT_TRUE(vm.Search("a222223333b"));
+  EXPECT_FALSE(vm.Matches("a22222b"));
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("23333"));
+
+  ScanScratch scratch;
+  const VM& const_vm = vm;
+  EXPECT_TRUE(const_vm.Matches("23", scratch));
+}
+
+TEST(RGVM, ExtractLiterals) {
+  RegexPtr a;
+  std::vector<std::string> literals;
+  EXPECT_TRUE(Parse("foo|bar|bazqux", a));
+  EXPECT_TRUE(ExtractLiterals(a, &literals));
+  ASSERT_THAT(literals, ::testing::ElementsAre("foo", "bar", "bazqux"));
+
+  for (const char* regexp : {"foo|ba.", "foo|(bar)", "fo+|bar", "a*"}) {
+    literals.clear();
+    EXPECT_TRUE(Parse(regexp, a));
+    EXPECT_FALSE(ExtractLiterals(a, &literals)) << regexp;
+  }
+}
+
+TEST(RGVM, AhoCorasick_SameAsPike) {
+  // Wrapping the alternation in a paren keeps it away from Aho-Corasick.
+  const std::vector<std::string> regexps = {
+      "ab", "foo|foobar", "foobar|foo", "a|ab|abc", "abc|ab|a", "bc|abcd|c",
+      "abcd|bc", "he|she|his|hers", "aa|aa|a", "x|y|z"};
+  const std::vector<std::string> subjects = {
+      "", "a", "abc", "abcd", "xfoobar", "foofoobar", "ushers", "ahishers",
+      "aaa", "zyx", "qqq"};
+  for (bool greedy : {true, false}) {
+    for (const auto& regexp : regexps) {
+      VM literal, pike;
+      literal.SetGreedy(greedy);
+      pike.SetGreedy(greedy);
+      literal.EnableStats(true);
+      ASSERT_TRUE(literal.Compile(regexp));
+      ASSERT_TRUE(pike.Compile("(" + regexp + ")"));
+      for (const auto& subject : subjects) {
+        SCOPED_TRACE(regexp + " ~ " + subject + (greedy ? "" : " (lazy)"));
+        const bool ok = pike.Search(subject);
+        ASSERT_EQ(literal.Search(subject), ok);
+        EXPECT_EQ(literal.Stats().engine, Engine::AhoCorasick);
+        EXPECT_EQ(literal.Matches(subject), ok);
+        EXPECT_TRUE(literal.Captures().empty());
+        if (!ok) continue;
+        EXPECT_EQ(literal.MatchSpan().begin, pike.MatchSpan().begin);
+        EXPECT_EQ(literal.MatchSpan().end, pike.MatchSpan().end);
+      }
+    }
+  }
+}
+
+TEST(RGVM, AhoCorasick_ManyKeywords) {
+  std::string regexp;
+  for (unsigned i = 0; i < 2000; ++i) {
+    if (i) regexp += '|';
+    regexp += "kw" + std::to_string(i * 7919) + "x";
+  }
+  VM vm;
+  ASSERT_TRUE(vm.Compile(regexp));
+  EXPECT_FALSE(vm.Search("no keyword kw12x kw7919 here"));
+  EXPECT_TRUE(vm.Search("one keyword kw79190x here"));
+  EXPECT_EQ(vm.MatchSpan().begin, 12u);
+  EXPECT_EQ(vm.MatchSpan().end, 20u);
+}
+
+TEST(RGVM, Simplify_NestedQuantifiers) {
+  const RegexPtr a = LitRegex('a');
+  EXPECT_EQ(Simplify(StarRegex(StarRegex(a))), StarRegex(a));
+  EXPECT_EQ(Simplify(PlusRegex(PlusRegex(a))), PlusRegex(a));
+  EXPECT_EQ(Simplify(QuestRegex(QuestRegex(a))), QuestRegex(a));
+  EXPECT_EQ(Simplify(QuestRegex(PlusRegex(a))), StarRegex(a));
+  EXPECT_EQ(Simplify(PlusRegex(QuestRegex(StarRegex(a)))), StarRegex(a));
+  // The paren owns a capture group.
+  const RegexPtr captured = StarRegex(ParenRegex(StarRegex(a)));
+  EXPECT_EQ(Simplify(captured), captured);
+}
+
+TEST(RGVM, Simplify_Alternatives) {
+  RegexPtr a;
+  EXPECT_TRUE(Parse("abc|abd", a));
+  EXPECT_EQ(Simplify(a),
+            ConcatRegex(LitRegex('a'),
+                        ConcatRegex(LitRegex('b'), AltRegex(LitRegex('c'),
+                                                            LitRegex('d')))));
+  EXPECT_LT(Count(Simplify(a)), Count(a));
+
+  EXPECT_TRUE(Parse("xbc|ybc", a));
+  EXPECT_EQ(Simplify(a),
+            ConcatRegex(AltRegex(LitRegex('x'), LitRegex('y')),
+                        ConcatRegex(LitRegex('b'), LitRegex('c'))));
+
+  EXPECT_TRUE(Parse("ab|ab|c", a));
+  EXPECT_EQ(Simplify(a),
+            AltRegex(ConcatRegex(LitRegex('a'), LitRegex('b')), LitRegex('c')));
+
+  // Nothing to do: a branch would be left empty, the parens own distinct
+  // capture groups, the shared items match more than a single character, the
+  // duplicates are not adjacent.
+  for (const char* regexp :
+       {"ab|a", "(a)|(a)", "a*b|a*c", "(a)b|(a)c", "ab|c|ab"}) {
+    EXPECT_TRUE(Parse(regexp, a));
+    EXPECT_EQ(Simplify(a), a) << regexp;
+  }
+}
+
+TEST(RGVM, FlatAst_RoundTrip) {
+  for (const char* regexp :
+       {"(23*)4(5+)", "a|bc|d", "((a)|b)+", "x(a.|b?)*y"}) {
+    RegexPtr a;
+    ASSERT_TRUE(Parse(regexp, a));
+    std::vector<internal::FlatNode> nodes;
+    const int root = internal::Flatten(a, nodes);
+    EXPECT_EQ(internal::Unflatten(nodes, root), a) << regexp;
+  }
+  // A node shared by several parents is flattened once.
+  const RegexPtr a = LitRegex('a');
+  std::vector<internal::FlatNode> nodes;
+  EXPECT_EQ(internal::Flatten(ConcatRegex(a, a), nodes), 1);
+  EXPECT_EQ(nodes.size(), 2u);
+}
+
+TEST(RGVM, Simplify_SameMatches) {
+  const std::vector<std::string> regexps = {
+      "abc|abd",       "ab|abc|abd",  "abd|ab|abc",  "xbc|ybc|bc",
+      "a.c|a.d|abe",   "(ab|ac)d",    "a(b|c)|a(b)", "ab|ab|a*",
+      "(a|ab)(c|bcd)", "aa*b|aa*c",   "ba|ca|a",     "(x|xy|xyz)z",
+      "x|xy|x",        "ab|c|ab|c"};
+  const std::vector<std::string> subjects = {
+      "",    "a",    "abc",   "abd",   "abcd", "xbcybc", "aabaac",
+      "acd", "bcba", "xyzzz", "xyzxz", "abe",  "qqq",    "abdabc"};
+  ScanScratch scratch;
+  for (const auto& regexp : regexps) {
+    RegexPtr a;
+    ASSERT_TRUE(Parse(regexp, a));
+    const auto raw = Compile(a);
+    const auto raw_reverse = CompileReverse(a);
+    const auto simplified = Compile(Simplify(a));
+    const auto simplified_reverse = CompileReverse(Simplify(a));
+    for (const auto& subject : subjects) {
+      EXPECT_EQ(MatchesAny(raw, subject, scratch),
+                MatchesAny(simplified, subject, scratch));
+      for (bool greedy : {true, false}) {
+        unsigned raw_end = 0, simplified_end = 0;
+        const bool ok = FindMatchEnd(raw, subject, greedy, scratch, &raw_end);
+        ASSERT_EQ(ok, FindMatchEnd(simplified, subject, greedy, scratch,
+                                   &simplified_end))
+            << regexp << " " << subject;
+        if (!ok) continue;
+        EXPECT_EQ(raw_end, simplified_end) << regexp << " " << subject;
+        unsigned raw_begin = 0, simplified_begin = 0;
+        EXPECT_TRUE(FindMatchStart(raw_reverse, subject, raw_end, scratch,
+                                   &raw_begin));
+        EXPECT_TRUE(FindMatchStart(simplified_reverse, subject, raw_end,
+                                   scratch, &simplified_begin));
+        EXPECT_EQ(raw_begin, simplified_begin) << regexp << " " << subject;
+      }
+    }
+  }
+}
+
+TEST(RGVM, Plan_Analysis) {
+  VM vm;
+  EXPECT_TRUE(vm.Compile("ERROR.*refused"));
+  EXPECT_EQ(vm.Plan().num_captures, 0u);
+  EXPECT_EQ(vm.Plan().num_literals, 0u);
+  EXPECT_EQ(vm.Plan().prefix, "ERROR");
+  EXPECT_TRUE(vm.Plan().ambiguous);
+  EXPECT_FALSE(vm.Plan().anchored);
+
+  EXPECT_TRUE(vm.Compile("(a|b)(c+)d"));
+  EXPECT_EQ(vm.Plan().num_captures, 2u);
+  EXPECT_EQ(vm.Plan().prefix, "");
+  EXPECT_EQ(vm.Plan().first_bytes.count(), 2u);
+  EXPECT_TRUE(vm.Plan().first_bytes['a']);
+  EXPECT_TRUE(vm.Plan().first_bytes['b']);
+  EXPECT_FALSE(vm.Plan().ambiguous);
+
+  EXPECT_TRUE(vm.Compile("foo|bar"));
+  EXPECT_EQ(vm.Plan().num_literals, 2u);
+
+  // May match the empty string, or start with any byte.
+  for (const char* regexp : {"a*", "x?", ".b", "a|.b"}) {
+    EXPECT_TRUE(vm.Compile(regexp));
+    EXPECT_TRUE(vm.Plan().first_bytes.all()) << regexp;
+  }
+}
+
+TEST(RGVM, Plan_Engine) {
+  VM vm;
+  vm.EnableStats(true);
+  EXPECT_TRUE(vm.Compile("foo|bar"));
+  EXPECT_TRUE(vm.Search("xbar"));
+  EXPECT_EQ(vm.Stats().engine, Engine::AhoCorasick);
+
+  EXPECT_TRUE(vm.Compile("b+c"));
+  EXPECT_TRUE(vm.Search("abbc"));
+  EXPECT_EQ(vm.Stats().engine, Engine::TwoPass);
+
+  EXPECT_TRUE(vm.Compile("a(b+)c"));
+  EXPECT_TRUE(vm.Search("abbbc"));
+  EXPECT_EQ(vm.Stats().engine, Engine::OnePass);
+
+  const std::string long_input = std::string(kTwoPassMinInput, 'x') + "abbbc";
+  EXPECT_TRUE(vm.Compile("a(b*b)c"));
+  EXPECT_TRUE(vm.Search("abbbc"));
+  EXPECT_EQ(vm.Stats().engine, Engine::Pike);
+  EXPECT_TRUE(vm.Search(long_input));
+  EXPECT_EQ(vm.Stats().engine, Engine::TwoPass);
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("bbb"));
+  EXPECT_EQ(vm.Stats().prefilter_skipped_bytes, kTwoPassMinInput);
+  // The two-pass scans do not enforce limits.
+  EXPECT_EQ(vm.Search(long_input, SearchLimits()), SearchStatus::Match);
+  EXPECT_EQ(vm.Stats().engine, Engine::Pike);
+
+  vm.SetEngine(Engine::AhoCorasick);
+  EXPECT_TRUE(vm.Search("abbbc"));
+  EXPECT_EQ(vm.Stats().engine, Engine::Pike);
+}
+
+TEST(RGVM, OnePass_Detection) {
+  for (const char* regexp :
+       {"(a+)(b+)", "(a*)(b*)", "(a|b)c", "x(a|b)*y", "(ab|cd)+e", "a.b"}) {
+    RegexPtr a;
+    ASSERT_TRUE(Parse(regexp, a));
+    EXPECT_TRUE(IsOnePass(Compile(a))) << regexp;
+  }
+  for (const char* regexp :
+       {"(a|ab)", "(.*)b", "(a*)(a*)", "(a|a)", "x(a|b)*a", "a.*b"}) {
+    RegexPtr a;
+    ASSERT_TRUE(Parse(regexp, a));
+    EXPECT_FALSE(IsOnePass(Compile(a))) << regexp;
+  }
+}
+
+TEST(RGVM, OnePass_SameAsPike) {
+  const std::vector<std::string> regexps = {
+      "(a+)(b+)", "(a*)(b*)",   "(a|b)c",    "x(a|b)*y",  "((ab|cd)+)e",
+      "(a)|(b)",  "a(b)?(c)?d", "(2+)3(4*)", "((a)|b)+c", "(a?)(b?)c"};
+  const std::vector<std::string> subjects = {
+      "",         "a",       "b",      "ab",         "aabbb",  "xaybyxabay",
+      "abcdabe",  "ac",      "bc",     "abd",        "acd",    "abcd",
+      "22234444", "2222345", "babac",  "aaabbbcccc", "abcdef", "c"};
+  for (bool greedy : {true, false}) {
+    for (const auto& regexp : regexps) {
+      VM one_pass, pike;
+      one_pass.SetGreedy(greedy);
+      pike.SetGreedy(greedy);
+      one_pass.EnableStats(true);
+      one_pass.SetEngine(Engine::OnePass);
+      pike.SetEngine(Engine::Pike);
+      ASSERT_TRUE(one_pass.Compile(regexp));
+      ASSERT_TRUE(pike.Compile(regexp));
+      for (const auto& subject : subjects) {
+        SCOPED_TRACE(regexp + " ~ " + subject + (greedy ? "" : " (lazy)"));
+        const bool ok = pike.Search(subject);
+        ASSERT_EQ(one_pass.Search(subject), ok);
+        EXPECT_EQ(one_pass.Captures(), pike.Captures());
+        if (!ok) continue;
+        EXPECT_EQ(one_pass.Stats().engine, Engine::OnePass);
+        EXPECT_EQ(one_pass.MatchSpan().begin, pike.MatchSpan().begin);
+        EXPECT_EQ(one_pass.MatchSpan().end, pike.MatchSpan().end);
+      }
+    }
+  }
+}
+
+TEST(RGVM, Plan_Prefilter) {
+  VM vm;
+  vm.EnableStats(true);
+  EXPECT_TRUE(vm.Compile("(a|b)c"));
+  EXPECT_FALSE(vm.Search("xxxxxx"));
+  EXPECT_EQ(vm.Stats().prefilter_skipped_bytes, 6u);
+  EXPECT_TRUE(vm.Search("xxxxbc"));
+  EXPECT_EQ(vm.Stats().prefilter_skipped_bytes, 4u);
+  EXPECT_EQ(vm.MatchSpan().begin, 4u);
+  ASSERT_THAT(vm.Captures(), ::testing::ElementsAre("b"));
+}
+
+TEST(RGVM, Jit_SameAsInterpreter) {
+  const std::vector<std::string> regexps = {
+      "ab",       "ab*",    "a.",       "(23+)4(5+)", "(a|ab)(c|bcd)(d*)",
+      "a*",       "x?",     "(a*)(b*)", "x(a|b)*y",   "(.*)b(.*)",
+      "a|bc|d.",  "(a*b)*c", ".",       "a.*b",       "((a)|b)+c"};
+  const std::vector<std::string> subjects = {
+      "",      "a",    "b",          "ab",   "aabbb", "a22222333345555555b",
+      "abcd",  "x",    "xaybyxabay", "ccc",  "bd",    "aababbc",
+      "zzzzy", "ba",   "xy",         "abab", "dz",    "2234"};
+  for (const auto& regexp : regexps) {
+    VM jit, interpreter;
+    jit.SetJit(true);
+    interpreter.SetJit(false);
+    ASSERT_TRUE(jit.Compile(regexp));
+    ASSERT_TRUE(interpreter.Compile(regexp));
+    // Literal alternations run on Aho-Corasick instead.
+    if (!jit.Plan().num_literals) {
+      EXPECT_EQ(jit.JitCompiled(), JitProgram::Supported()) << regexp;
+    }
+    EXPECT_FALSE(interpreter.JitCompiled());
+    for (const auto& subject : subjects) {
+      SCOPED_TRACE(regexp + " ~ " + subject);
+      EXPECT_EQ(jit.Matches(subject), interpreter.Matches(subject));
+      const bool ok = interpreter.Search(subject);
+      ASSERT_EQ(jit.Search(subject), ok);
+      EXPECT_EQ(jit.Captures(), interpreter.Captures());
+    }
+  }
+}
+
+TEST(RGVM, Jit_ByDefault) {
+  VM::SetJitByDefault(true);
+  VM on;
+  VM::SetJitByDefault(false);
+  VM off;
+  VM::SetJitByDefault(kJitByDefault);
+  ASSERT_TRUE(on.Compile("(a|b)c"));
+  ASSERT_TRUE(off.Compile("(a|b)c"));
+  EXPECT_EQ(on.JitCompiled(), JitProgram::Supported());
+  EXPECT_FALSE(off.JitCompiled());
+}
+
+TEST(RGVM, Jit_TooManyPositions) {
+  const unsigned n = JitProgram::kMaxPositions;
+  VM vm;
+  vm.SetJit(true);
+  EXPECT_TRUE(vm.Compile(std::string(n, 'a') + "."));
+  EXPECT_FALSE(vm.JitCompiled());
+  EXPECT_TRUE(vm.Matches(std::string(n + 1, 'a')));
+  EXPECT_TRUE(vm.Compile(std::string(n - 1, 'a') + "."));
+  EXPECT_EQ(vm.JitCompiled(), JitProgram::Supported());
+  EXPECT_TRUE(vm.Matches(std::string(n + 1, 'a')));
+  EXPECT_FALSE(vm.Matches(std::string(n - 1, 'a')));
+}
+
+const std::vector<std::string> kStaticSubjects = {
+    "",     "a",          "b",      "ab",        "aabbb", "a22222333345555555b",
+    "abcd", "xaybyxabay", "ccc",    "bd",        "aaaa",  "babab",
+    "abab", "234455",     "2 3 4 5", "aaabbbccc", "xy",    "aab"};
+
+// Searches every subject with both |Matcher| and the VM running |regexp|, and
+// expects the same outcome, span and captures.
+template <typename Matcher>
+void ExpectSameAsVM(const std::string& regexp) {
+  for (bool greedy : {true, false}) {
+    Matcher regex;
+    VM vm;
+    regex.SetGreedy(greedy);
+    vm.SetGreedy(greedy);
+    ASSERT_TRUE(vm.Compile(regexp));
+    for (const auto& subject : kStaticSubjects) {
+      SCOPED_TRACE(regexp + " ~ " + subject + (greedy ? "" : " (lazy)"));
+      const bool ok = vm.Search(subject);
+      EXPECT_EQ(regex.Matches(subject), ok);
+      ASSERT_EQ(regex.Search(subject), ok);
+      EXPECT_EQ(regex.Captures(), vm.Captures());
+      if (!ok) continue;
+      EXPECT_EQ(regex.MatchSpan().begin, vm.MatchSpan().begin);
+      EXPECT_EQ(regex.MatchSpan().end, vm.MatchSpan().end);
+    }
+  }
+}
+
+TEST(RGVM, DirectThreadList_GenerationWraps) {
+  DirectThreadList<4, 0> list;
+  list.generation = ~0u;
+  ASSERT_TRUE(list.Visit(2));
+  list.Clear();
+  // The PCs not visited since the wrap are still free.
+  EXPECT_TRUE(list.Visit(1));
+  EXPECT_FALSE(list.Visit(1));
+  EXPECT_TRUE(list.Visit(2));
+}
+
+TEST(RGVM, StaticRegex_Parse) {
+  static_assert(internal::ParseStatic(FixedString("(23*)4(5+)")).root >= 0);
+  static_assert(internal::ParseStatic(FixedString("(a")).root < 0);
+  static_assert(internal::ParseStatic(FixedString("*a")).root < 0);
+  static_assert(internal::ParseStatic(FixedString("")).root < 0);
+  // Like Parse(), leading and trailing spaces are skipped, and anything else
+  // left after the regexp is rejected.
+  static_assert(internal::StaticProgram<"  ab ">::kSize == 3);
+  static_assert(internal::ParseStatic(FixedString("ab c")).root < 0);
+  static_assert(internal::ParseStatic(FixedString("x)")).root < 0);
+  static_assert(internal::StaticProgram<"(23*)4(5+)">::kNumSlots == 4);
+}
+
+// Also expects the same program as VM::Compile().
+template <FixedString kPattern>
+void ExpectStaticSameAsVM() {
+  RegexPtr a;
+  ASSERT_TRUE(Parse(kPattern.data, a));
+  const auto program = Compile(Simplify(a));
+  const auto& instructions = internal::StaticProgram<kPattern>::kInstructions;
+  ASSERT_EQ(instructions.size(), program.size());
+  for (size_t pc = 0; pc < program.size(); ++pc)
+    EXPECT_EQ(instructions[pc], program[pc]) << kPattern.data << " " << pc;
+  ExpectSameAsVM<StaticRegex<kPattern>>(kPattern.data);
+}
+
+TEST(RGVM, StaticRegex_SameAsVM) {
+  ExpectStaticSameAsVM<"(23*)4(5+)">();
+  ExpectStaticSameAsVM<"ab*">();
+  ExpectStaticSameAsVM<"a.">();
+  ExpectStaticSameAsVM<"(a|ab)(c|bcd)(d*)">();
+  ExpectStaticSameAsVM<"(a*)(b*)">();
+  ExpectStaticSameAsVM<"((a)|b)+">();
+  ExpectStaticSameAsVM<"(.*)b(.*)">();
+  ExpectStaticSameAsVM<"(a+)|(b+)">();
+  ExpectStaticSameAsVM<"x(a|b)*y">();
+  ExpectStaticSameAsVM<"(aa|a)(aa|a)">();
+  ExpectStaticSameAsVM<"a|bc|d">();
+  ExpectStaticSameAsVM<"(a*b)*c">();
+  ExpectStaticSameAsVM<" 234 ">();
+  // Simplified.
+  ExpectStaticSameAsVM<"abc|abd|ab">();
+  ExpectStaticSameAsVM<"xz|yz|z">();
+  ExpectStaticSameAsVM<"ab|ab|c|ab">();
+  ExpectStaticSameAsVM<"(a.c|a.d)e">();
+  // More than 64 instructions, over two blocks of the dispatch.
+  ExpectStaticSameAsVM<"(a|b|c|d|e|f|g|h|i|j)(k|l|m|n|o|p|q|r|s|t)u*v*w*x*">();
+}
+
+TEST(RGVM, Codegen_SameAsVM) {
+  ExpectSameAsVM<rules::Numbers>("(23*)4(5+)");
+  ExpectSameAsVM<rules::Ambiguous>("(a|ab)(c|bcd)(d*)");
+  ExpectSameAsVM<rules::Keywords>("foo|bar|bazqux");
+  ExpectSameAsVM<rules::Repeated>("((a)|b)+");
+  ExpectSameAsVM<rules::Lazy>("x(a|b)*y");
+  ExpectSameAsVM<rules::Dots>("(.*)b(.*)");
+}
+
+std::unique_ptr<Dfa> BuildDfa(const std::string& regexp,
+                              unsigned max_states = Dfa::kMaxStates) {
+  RegexPtr a;
+  EXPECT_TRUE(Parse(regexp, a));
+  return Dfa::Build(Compile(a), max_states);
+}
+
+TEST(RGVM, Dfa_SameAsInterpreter) {
+  const std::vector<std::string> regexps = {
+      "ab",       "ab*",    "a.",       "(23+)4(5+)", "(a|ab)(c|bcd)(d*)",
+      "a*",       "x?",     "(a*)(b*)", "x(a|b)*y",   "(.*)b(.*)",
+      "a|bc|d.",  "(a*b)*c", ".",       "a.*b",       "((a)|b)+c"};
+  const std::vector<std::string> subjects = {
+      "",      "a",    "b",          "ab",   "aabbb", "a22222333345555555b",
+      "abcd",  "x",    "xaybyxabay", "ccc",  "bd",    "aababbc",
+      "zzzzy", "ba",   "xy",         "abab", "dz",    "2234"};
+  for (const auto& regexp : regexps) {
+    auto dfa = BuildDfa(regexp);
+    ASSERT_NE(dfa, nullptr) << regexp;
+    auto imported = Dfa::Import(dfa->Export());
+    ASSERT_NE(imported, nullptr) << regexp;
+    VM vm;
+    ASSERT_TRUE(vm.Compile(regexp));
+    for (const auto& subject : subjects) {
+      SCOPED_TRACE(regexp + " ~ " + subject);
+      EXPECT_EQ(dfa->Matches(subject), vm.Matches(subject));
+      EXPECT_EQ(imported->Matches(subject), vm.Matches(subject));
+    }
+  }
+}
+
+TEST(RGVM, Dfa_Minimal) {
+  // Start, after "a", and matched.
+  auto dfa = BuildDfa("ab");
+  EXPECT_EQ(dfa->NumStates(), 3);
+  EXPECT_EQ(dfa->NumClasses(), 3);
+  // Any non-empty text matches, whatever its bytes.
+  dfa = BuildDfa("(a|b)*");
+  EXPECT_EQ(dfa->NumStates(), 2);
+  EXPECT_EQ(dfa->NumClasses(), 1);
+  // Equivalent programs have the same minimal DFA.
+  for (const auto& [a, b] : std::vector<std::pair<std::string, std::string>>{
+           {"a*b", "b"}, {"(ab|ac)d", "a(b|c)d"}, {"x(a|b)*y", "x(a*b*)*y"}}) {
+    auto dfa_a = BuildDfa(a), dfa_b = BuildDfa(b);
+    EXPECT_EQ(dfa_a->Export(), dfa_b->Export()) << a << " vs " << b;
+  }
+  EXPECT_EQ(BuildDfa("ab", 2), nullptr);
+  EXPECT_NE(BuildDfa("ab", 3), nullptr);
+}
+
+TEST(RGVM, Dfa_Import) {
+  const std::string tables = BuildDfa("(a|ab)(c|bcd)(d*)")->Export();
+  auto dfa = Dfa::Import(tables);
+  ASSERT_NE(dfa, nullptr);
+  EXPECT_EQ(dfa->Export(), tables);
+  EXPECT_EQ(Dfa::Import(""), nullptr);
+  EXPECT_EQ(Dfa::Import(tables.substr(0, tables.size() - 1)), nullptr);
+  EXPECT_EQ(Dfa::Import(tables + "x"), nullptr);
+  std::string corrupted = tables;
+  corrupted[0] = 'X';
+  EXPECT_EQ(Dfa::Import(corrupted), nullptr);
+  // Transition to a state that does not exist.
+  corrupted = tables;
+  corrupted.back() = static_cast<char>(dfa->NumStates());
+  EXPECT_EQ(Dfa::Import(corrupted), nullptr);
+}
+
+TEST(RGVM, Bundle_CompileAll) {
+  std::vector<std::string> patterns;
+  for (unsigned i = 0; i < 200; ++i) {
+    patterns.push_back("(k" + std::to_string(i) + ")+x");
+    if (i % 50 == 0) patterns.push_back("(a");
+  }
+  const std::string subject = "k17k17xk150x";
+  for (unsigned num_threads : {0, 1, 3, 1000}) {
+    auto results = CompileAll(patterns, num_threads);
+    ASSERT_EQ(results.size(), patterns.size());
+    for (unsigned i = 0; i < patterns.size(); ++i) {
+      SCOPED_TRACE(patterns[i]);
+      VM vm;
+      const bool ok = vm.Compile(patterns[i]);
+      ASSERT_EQ(results[i].ok, ok);
+      EXPECT_EQ(results[i].error.empty(), ok);
+      if (!ok) continue;
+      EXPECT_EQ(results[i].vm.Search(subject), vm.Search(subject));
+      EXPECT_EQ(results[i].vm.Captures(), vm.Captures());
+    }
+  }
+  EXPECT_TRUE(CompileAll({}).empty());
+  // A valid prefix is not enough: the error tells where parsing stopped.
+  const auto partial = CompileAll({"x)", "a)b", "foo bar", " ab "});
+  ASSERT_EQ(partial.size(), 4u);
+  EXPECT_FALSE(partial[0].ok);
+  EXPECT_NE(partial[0].error.find("offset 1: \")\""), std::string::npos)
+      << partial[0].error;
+  EXPECT_FALSE(partial[1].ok);
+  EXPECT_NE(partial[1].error.find("offset 1: \")b\""), std::string::npos)
+      << partial[1].error;
+  EXPECT_FALSE(partial[2].ok);
+  EXPECT_TRUE(partial[3].ok);
+}
+
+TEST(RGVM, Incremental_SameAsSearch) {
+  const std::vector<std::string> regexps = {
+      "(23*)4(5+)", "(a|ab)(c|bcd)(d*)", "x(a|b)*y", "(.*)b(.*)", "a*",
+      "foo|bar",    "((a)|b)+c",         "(a*b)*c"};
+  // Offset, removed and inserted text of every edit, applied in order.
+  const std::vector<std::tuple<unsigned, unsigned, std::string>> edits = {
+      {0, 0, "zzz"},   {10, 3, ""},    {5, 0, "abcd"}, {20, 1, "x"},
+      {0, 4, "ab"},    {30, 0, "y"},   {12, 6, "bbc"}, {40, 0, "foo"},
+      {2, 0, "23445"}, {25, 10, "bd"}, {0, 0, ""},     {3, 1, "bar"}};
+  for (const auto& regexp : regexps) {
+    for (bool greedy : {true, false}) {
+      for (unsigned interval : {1, 4, 4096}) {
+        std::string text =
+            "qqaqbxayqqq2234455qqabcdqqqxababyqqqqaabbcqqqqqqfo";
+        IncrementalSearch incremental;
+        VM vm;
+        ASSERT_TRUE(incremental.Compile(regexp));
+        ASSERT_TRUE(vm.Compile(regexp));
+        incremental.SetGreedy(greedy);
+        vm.SetGreedy(greedy);
+        incremental.SetCheckpointInterval(interval);
+        EXPECT_EQ(incremental.Search(text), vm.Search(text));
+        for (const auto& [offset, removed, inserted] : edits) {
+          text.replace(offset, removed, inserted);
+          SCOPED_TRACE(regexp + " ~ " + text + (greedy ? "" : " (lazy)") +
+                       " every " + std::to_string(interval));
+          const bool ok = vm.Search(text);
+          ASSERT_EQ(incremental.Update(text, offset, removed, inserted.size()),
+                    ok);
+          EXPECT_EQ(incremental.Captures(), vm.Captures());
+          if (ok) {
+            EXPECT_EQ(incremental.MatchSpan().begin, vm.MatchSpan().begin);
+            EXPECT_EQ(incremental.MatchSpan().end, vm.MatchSpan().end);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(RGVM, Incremental_ScansEditWindow) {
+  IncrementalSearch incremental;
+  ASSERT_TRUE(incremental.Compile("(ab+)c"));
+  incremental.SetCheckpointInterval(64);
+  std::string text(1 << 16, 'a');
+  EXPECT_FALSE(incremental.Search(text));
+  EXPECT_EQ(incremental.ScannedBytes(), text.size());
+
+  text.replace(30000, 1, "bb");
+  EXPECT_FALSE(incremental.Update(text, 30000, 1, 2));
+  EXPECT_LE(incremental.ScannedBytes(), 128);
+  text.replace(40000, 1, "bc");
+  EXPECT_TRUE(incremental.Update(text, 40000, 1, 2));
+  EXPECT_LE(incremental.ScannedBytes(), 128);
+  EXPECT_EQ(incremental.Captures(), std::vector<std::string>{"ab"});
+  // Past the match.
+  text.replace(50000, 0, "b");
+  EXPECT_TRUE(incremental.Update(text, 50000, 0, 1));
+  EXPECT_EQ(incremental.ScannedBytes(), 0);
+  EXPECT_EQ(incremental.MatchSpan().begin, 39999);
+}
+
+TEST(RGVM, Search_CaptureSpans) {
+  const std::vector<std::string> regexps = {
+      "(23*)4(5+)", "(a|ab)(c|bcd)(d*)", "(.*)b(.*)", "((a)|b)+", "(b|(a))(c)",
+      "a|(b)"};
+  for (const auto& regexp : regexps) {
+    VM vm, spans;
+    ASSERT_TRUE(vm.Compile(regexp));
+    ASSERT_TRUE(spans.Compile(regexp));
+    for (const auto& subject : kStaticSubjects) {
+      SCOPED_TRACE(regexp + " ~ " + subject);
+      const bool ok = vm.Search(subject);
+      ASSERT_EQ(spans.SearchSpans(subject), ok);
+      EXPECT_TRUE(spans.Captures().empty());
+      ASSERT_EQ(spans.CaptureSpans().size(), vm.Captures().size());
+      for (unsigned i = 0; i < vm.Captures().size(); ++i) {
+        const Span span = spans.CaptureSpans()[i];
+        EXPECT_EQ(vm.CaptureSpans()[i].begin, span.begin);
+        EXPECT_EQ(vm.CaptureSpans()[i].end, span.end);
+        EXPECT_EQ(subject.substr(span.begin, span.end - span.begin),
+                  vm.Captures()[i]);
+      }
+    }
+  }
+}
+
+TEST(RGVM, Rewrite_Template) {
+  ReplaceTemplate replacement;
+  EXPECT_FALSE(replacement.Compile("a$"));
+  EXPECT_FALSE(replacement.Compile("$a"));
+  ASSERT_TRUE(replacement.Compile("<$2:$1$$$0$9>"));
+  const std::string text = "xaabby";
+  const std::vector<Span> captures = {{1, 3}, {3, 5}};
+  const Span match{1, 5};
+  ASSERT_EQ(replacement.Size(match, captures), 12);
+  std::string out(12, ' ');
+  EXPECT_EQ(replacement.Expand(text, match, captures, out.data()),
+            out.data() + out.size());
+  EXPECT_EQ(out, "<bb:aa$aabb>");
+}
+
+TEST(RGVM, Rewrite_Replace) {
+  VM vm;
+  ASSERT_TRUE(vm.Compile("(a+)(b+)"));
+  ReplaceTemplate replacement;
+  ASSERT_TRUE(replacement.Compile("[$2$1]"));
+  std::string out;
+  EXPECT_EQ(ReplaceAll(vm, "xaabyabbbz", replacement, &out), 2);
+  EXPECT_EQ(out, "x[baa]y[bbba]z");
+  EXPECT_TRUE(Replace(vm, "xaabyabbbz", replacement, &out));
+  EXPECT_EQ(out, "x[baa]yabbbz");
+  EXPECT_FALSE(Replace(vm, "xyz", replacement, &out));
+  EXPECT_EQ(out, "xyz");
+  EXPECT_EQ(ReplaceAll(vm, "", replacement, &out), 0);
+  EXPECT_EQ(out, "");
+
+  // Empty matches.
+  ASSERT_TRUE(vm.Compile("x*"));
+  ASSERT_TRUE(replacement.Compile("-"));
+  EXPECT_EQ(ReplaceAll(vm, "abxxc", replacement, &out), 4);
+  EXPECT_EQ(out, "-a-b--c");
+}
+
+TEST(RGVM, Rewrite_Split) {
+  const auto split = [](const std::string& regexp, std::string_view text) {
+    VM vm;
+    EXPECT_TRUE(vm.Compile(regexp));
+    std::vector<std::string_view> pieces;
+    Splitter splitter(vm, text);
+    for (std::string_view piece; splitter.Next(&piece);)
+      pieces.push_back(piece);
+    EXPECT_FALSE(splitter.Next(&pieces.back()));
+    return pieces;
+  };
+  using Pieces = std::vector<std::string_view>;
+  EXPECT_EQ(split("x+", "axxbxc"), (Pieces{"a", "b", "c"}));
+  EXPECT_EQ(split("x+", "xabx"), (Pieces{"", "ab", ""}));
+  EXPECT_EQ(split("x+", ""), (Pieces{""}));
+  EXPECT_EQ(split("y*", "abc"), (Pieces{"abc"}));
+  EXPECT_EQ(split("a(b|c)", "1ab2ac3"), (Pieces{"1", "2", "3"}));
+  // The pieces point into the text.
+  const std::string text = "1x2";
+  EXPECT_EQ(split("x", text)[1].data(), text.data() + 2);
+}
+
+// Matches of |vm| in |text| as ReplaceAll() finds them.
+std::vector<std::pair<unsigned, unsigned>> AllMatches(VM& vm,
+                                                      std::string_view text) {
+  std::vector<std::pair<unsigned, unsigned>> matches;
+  for (unsigned pos = 0;
+       pos < text.size() && vm.SearchSpans(text.substr(pos));) {
+    const Span span = vm.MatchSpan();
+    matches.emplace_back(pos + span.begin, pos + span.end);
+    pos += span.end > span.begin ? span.end : span.end + 1;
+  }
+  return matches;
+}
+
+TEST(RGVM, Stream_SameAsSearch) {
+  const std::vector<std::string> regexps = {
+      "(23*)4(5+)", "(a|ab)(c|bcd)(d*)", "(.*)b(.*)", "((a)|b)+", "a*",
+      "foo|bar",    "x(a|b)*y",          "ab",        "a.",       "b*a"};
+  std::vector<std::string> subjects = kStaticSubjects;
+  subjects.push_back("xabyaab22344555xaabbyfoobarbbbbabab");
+  for (const auto& regexp : regexps) {
+    for (bool greedy : {true, false}) {
+      VM vm;
+      StreamMatcher matcher;
+      ASSERT_TRUE(vm.Compile(regexp));
+      ASSERT_TRUE(matcher.Compile(regexp));
+      vm.SetGreedy(greedy);
+      matcher.SetGreedy(greedy);
+      for (const auto& subject : subjects) {
+        const auto expected = AllMatches(vm, subject);
+        for (unsigned chunk : {1, 2, 3, 7, 100}) {
+          SCOPED_TRACE(regexp + " ~ " + subject + (greedy ? "" : " (lazy)") +
+                       " by " + std::to_string(chunk));
+          std::vector<StreamMatch> matches;
+          for (unsigned i = 0; i < subject.size(); i += chunk)
+            matcher.Feed(std::string_view(subject).substr(i, chunk), &matches);
+          matcher.Finish(&matches);
+          std::vector<std::pair<unsigned, unsigned>> actual;
+          for (const auto& match : matches)
+            actual.emplace_back(match.begin, match.end);
+          EXPECT_EQ(actual, expected);
+        }
+      }
+    }
+  }
+}
+
+TEST(RGVM, Stream_Buffer) {
+  StreamMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("a(b+)c"));
+  std::vector<StreamMatch> matches;
+  for (unsigned i = 0; i < 1000; ++i) matcher.Feed("xxxxxxxxab", &matches);
+  EXPECT_TRUE(matches.empty());
+  EXPECT_LE(matcher.BufferedBytes(), 20);
+  // Final as soon as the highest priority thread matches.
+  matcher.Feed("bc", &matches);
+  ASSERT_EQ(matches.size(), 1);
+  EXPECT_EQ(matches[0].begin, 9998);
+  EXPECT_EQ(matches[0].end, 10002);
+  EXPECT_EQ(matcher.BufferedBytes(), 0);
+}
+
+// Chunk source of MatchStream(): the reader is suspended until the test
+// pushes the next chunk.
+class Channel {
+ public:
+  auto Read() {
+    struct Awaiter {
+      Channel& channel;
+
+      bool await_ready() { return !channel.chunks_.empty(); }
+      void await_suspend(std::coroutine_handle<> reader) {
+        channel.reader_ = reader;
+      }
+      std::string await_resume() {
+        if (channel.failed_) throw std::runtime_error("read failed");
+        std::string chunk = std::move(channel.chunks_.front());
+        channel.chunks_.pop_front();
+        return chunk;
+      }
+    };
+    return Awaiter{*this};
+  }
+
+  void Push(std::string chunk) {
+    chunks_.push_back(std::move(chunk));
+    if (auto reader = std::exchange(reader_, nullptr)) reader.resume();
+  }
+
+  // Makes the pending read, and the next ones, throw.
+  void Fail() {
+    failed_ = true;
+    if (auto reader = std::exchange(reader_, nullptr)) reader.resume();
+  }
+
+ private:
+  bool failed_ = false;
+  std::deque<std::string> chunks_;
+  std::coroutine_handle<> reader_;
+};
+
+// Coroutine started right away and left to run on its own.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Detached Collect(MatchGenerator& generator, std::vector<StreamMatch>* matches,
+                 bool* done, std::string* error = nullptr) {
+  try {
+    while (auto match = co_await generator.Next()) matches->push_back(*match);
+  } catch (const std::exception& e) {
+    if (error) *error = e.what();
+  }
+  *done = true;
+}
+
+TEST(RGVM, Stream_Coroutine) {
+  StreamMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("(a+)b"));
+  Channel channel;
+  MatchGenerator generator =
+      MatchStream(matcher, [&] { return channel.Read(); });
+  std::vector<StreamMatch> matches;
+  bool done = false;
+  Collect(generator, &matches, &done);
+  EXPECT_TRUE(matches.empty());
+
+  channel.Push("xaab");
+  ASSERT_EQ(matches.size(), 1);
+  EXPECT_EQ(matches[0].begin, 1);
+  EXPECT_EQ(matches[0].end, 4);
+  channel.Push("yaa");
+  EXPECT_EQ(matches.size(), 1);
+  channel.Push("abab");
+  ASSERT_EQ(matches.size(), 3);
+  EXPECT_EQ(matches[1].begin, 5);
+  EXPECT_EQ(matches[2].end, 11);
+  EXPECT_FALSE(done);
+  channel.Push("");
+  EXPECT_TRUE(done);
+  EXPECT_EQ(matches.size(), 3);
+}
+
+TEST(RGVM, Stream_CoroutineReadFails) {
+  StreamMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("(a+)b"));
+  Channel channel;
+  MatchGenerator generator =
+      MatchStream(matcher, [&] { return channel.Read(); });
+  std::vector<StreamMatch> matches;
+  bool done = false;
+  std::string error;
+  Collect(generator, &matches, &done, &error);
+  channel.Push("xaab");
+  ASSERT_EQ(matches.size(), 1);
+  channel.Fail();
+  // The consumer gets the exception, and the stream is over.
+  EXPECT_TRUE(done);
+  EXPECT_EQ(error, "read failed");
+  EXPECT_EQ(matches.size(), 1);
+}
+
+// Writes |members| to |path| as consecutive gzip members.
+void WriteGzip(const std::string& path,
+               const std::vector<std::string>& members) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc);
+  for (const auto& member : members) {
+    gzFile file = gzopen(path.c_str(), "ab");
+    ASSERT_NE(file, nullptr);
+    ASSERT_EQ(gzwrite(file, member.data(), member.size()), member.size());
+    gzclose(file);
+  }
+}
+
+std::vector<std::pair<unsigned, unsigned>> ScanGzip(
+    const std::string& path, StreamMatcher& matcher,
+    const GzipScanOptions& options, bool* ok) {
+  std::vector<std::pair<unsigned, unsigned>> matches;
+  *ok = ScanGzipFile(
+      path, matcher,
+      [&](const StreamMatch& match) {
+        matches.emplace_back(match.begin, match.end);
+      },
+      options);
+  return matches;
+}
+
+TEST(RGVM, Gzip_SameAsSearch) {
+  std::string text;
+  for (unsigned i = 0; text.size() < 100000; ++i)
+    text += "line " + std::to_string(i) + (i % 97 ? " ok\n" : " ERROR 42\n");
+  const std::string path = testing::TempDir() + "rgvm_gzip_test.gz";
+  // Split into members at arbitrary offsets.
+  WriteGzip(path, {text.substr(0, 1234), text.substr(1234, 50000),
+                   text.substr(51234)});
+
+  VM vm;
+  StreamMatcher matcher;
+  ASSERT_TRUE(vm.Compile("ERROR.(4+)2"));
+  ASSERT_TRUE(matcher.Compile("ERROR.(4+)2"));
+  const auto expected = AllMatches(vm, text);
+  ASSERT_GT(expected.size(), 10);
+  for (const auto& options : {GzipScanOptions{}, GzipScanOptions{7, 2},
+                              GzipScanOptions{4096, 1}}) {
+    bool ok = false;
+    EXPECT_EQ(ScanGzip(path, matcher, options, &ok), expected);
+    EXPECT_TRUE(ok);
+  }
+
+  // Uncompressed files are read as they are.
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << text;
+  bool ok = false;
+  EXPECT_EQ(ScanGzip(path, matcher, {}, &ok), expected);
+  EXPECT_TRUE(ok);
+}
+
+TEST(RGVM, Gzip_Errors) {
+  StreamMatcher matcher;
+  ASSERT_TRUE(matcher.Compile("ab"));
+  bool ok = true;
+  EXPECT_TRUE(
+      ScanGzip(testing::TempDir() + "rgvm_no_such_file.gz", matcher, {}, &ok)
+          .empty());
+  EXPECT_FALSE(ok);
+
+  // Truncated: the matches before the cut are still reported.
+  const std::string path = testing::TempDir() + "rgvm_truncated.gz";
+  WriteGzip(path, {"xxab" + std::string(100000, 'y') + "ab"});
+  std::ifstream in(path, std::ios::binary);
+  std::string compressed((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  std::ofstream(path, std::ios::binary | std::ios::trunc)
+      << compressed.substr(0, compressed.size() - 10);
+  const auto matches = ScanGzip(path, matcher, {}, &ok);
+  EXPECT_FALSE(ok);
+  EXPECT_EQ(matches, (std::vector<std::pair<unsigned, unsigned>>{{2, 4}}));
+
+  // A throwing callback stops the scan without leaving the reader behind.
+  std::string text;
+  for (unsigned i = 0; i < 10000; ++i) text += "ab";
+  WriteGzip(path, {text});
+  unsigned calls = 0;
+  EXPECT_THROW(ScanGzipFile(
+                   path, matcher,
+                   [&](const StreamMatch&) {
+                     if (++calls == 3) throw std::runtime_error("stop");
+                   },
+                   GzipScanOptions{16, 2}),
+               std::runtime_error);
+  EXPECT_EQ(calls, 3);
+}
+
+TEST(RGVM, Matrix_SameAsMatches) {
+  std::vector<VM> vms(40);
+  std::vector<const VM*> patterns;
+  for (unsigned i = 0; i < vms.size(); ++i) {
+    vms[i].SetJit(i % 2 == 0);
+    ASSERT_TRUE(vms[i].Compile("(k" + std::to_string(i % 13) + ")+x|y" +
+                               std::to_string(i)));
+    patterns.push_back(&vms[i]);
+  }
+  std::vector<std::string> texts;
+  for (unsigned i = 0; i < 150; ++i) {
+    std::string& text = texts.emplace_back("k");
+    text.append(std::to_string(i % 17)).append("x y");
+    text.append(std::to_string(i % 45));
+  }
+  const std::vector<std::string_view> documents(texts.begin(), texts.end());
+  for (const MatrixOptions& options :
+       {MatrixOptions{}, MatrixOptions{1, 1, 1}, MatrixOptions{3, 7, 11},
+        MatrixOptions{8, 100, 1000}, MatrixOptions{1000, 0, 0}}) {
+    const HitMatrix matrix = MatchMatrix(patterns, documents, options);
+    ASSERT_EQ(matrix.offsets.size(), documents.size() + 1);
+    std::vector<unsigned> expected;
+    for (unsigned d = 0; d < documents.size(); ++d) {
+      for (unsigned p = 0; p < patterns.size(); ++p) {
+        const bool hit = vms[p].Matches(documents[d]);
+        if (hit) expected.push_back(p);
+        EXPECT_EQ(matrix.Hit(p, d), hit) << p << " " << d;
+      }
+    }
+    EXPECT_EQ(matrix.patterns, expected);
+  }
+  EXPECT_EQ(MatchMatrix(patterns, {}).NumHits(), 0);
+  EXPECT_EQ(MatchMatrix({}, documents).offsets,
+            std::vector<unsigned>(documents.size() + 1));
+}
+
+TEST(RGVM, Memory_Usage) {
+  VM vm;
+  // Matches() only needs a scan scratch on the interpreter.
+  vm.SetJit(false);
+  ASSERT_TRUE(vm.Compile("(a|b)*c(d+)"));
+  MemoryReport report = vm.MemoryUsage();
+  EXPECT_GT(report.ast, 0);
+  EXPECT_GE(report.program, sizeof(VM));
+  EXPECT_GT(report.accelerators, 0);
+  EXPECT_EQ(report.captures, 0);
+  ASSERT_TRUE(vm.Search("xxababcddd"));
+  report = vm.MemoryUsage();
+  EXPECT_GT(report.scratch, 0);
+  EXPECT_GT(report.captures, 0);
+  EXPECT_EQ(report.Total(), report.ast + report.program + report.accelerators +
+                                report.scratch + report.captures);
+
+  ScanScratch scratch;
+  EXPECT_EQ(scratch.MemoryUsage(), 0);
+  EXPECT_TRUE(vm.Matches("abcd", scratch));
+  EXPECT_GT(scratch.MemoryUsage(), 0);
+
+  VM literals;
+  ASSERT_TRUE(literals.Compile("foo|bar"));
+  EXPECT_GT(literals.MemoryUsage().accelerators, 0);
+}
+
+TEST(RGVM, Memory_Budget) {
+  const std::vector<std::string> regexps = {"(a|b)*c(d+)", "(23*)4(5+)",
+                                            "foo|bar", "(a*b)*c", "x(.)y"};
+  const std::vector<std::string> texts = {"xxababcddd", "1233455", "zbarfoo",
+                                          "aabab", "xxzy"};
+  MemoryBudget budget;
+  budget.retain_ast = false;
+  budget.max_accelerator_bytes = 1;
+  budget.max_scratch_bytes = 64;
+  for (const std::string& regexp : regexps) {
+    SCOPED_TRACE(regexp);
+    VM unlimited;
+    ASSERT_TRUE(unlimited.Compile(regexp));
+    SetMemoryBudget(budget);
+    VM vm;
+    const bool ok = vm.Compile(regexp);
+    SetMemoryBudget({});
+    ASSERT_TRUE(ok);
+    EXPECT_EQ(vm.MemoryUsage().ast, 0);
+    EXPECT_FALSE(vm.JitCompiled());
+    EXPECT_LE(vm.MemoryUsage().accelerators,
+              unlimited.MemoryUsage().accelerators);
+    for (Engine engine : {Engine::Auto, Engine::Pike, Engine::TwoPass,
+                          Engine::OnePass}) {
+      vm.SetEngine(engine);
+      unlimited.SetEngine(engine);
+      for (const std::string& text : texts) {
+        SetMemoryBudget(budget);
+        const bool matched = vm.Search(text);
+        EXPECT_LE(vm.MemoryUsage().scratch, budget.max_scratch_bytes);
+        EXPECT_EQ(vm.Matches(text), matched);
+        EXPECT_LE(vm.MemoryUsage().scratch, budget.max_scratch_bytes);
+        SetMemoryBudget({});
+        EXPECT_EQ(matched, unlimited.Search(text)) << text;
+        EXPECT_EQ(vm.Captures(), unlimited.Captures()) << text;
+      }
+    }
+  }
+  EXPECT_TRUE(GetMemoryBudget().retain_ast);
+  EXPECT_EQ(GetMemoryBudget().max_scratch_bytes, 0);
+}
+
 int main(int argc, char *argv[]) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();